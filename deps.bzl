@@ -27,6 +27,14 @@ def rhutil_deps():
         repo_mapping = {"@com_google_absl": "@abseil"}
     )
 
+  if not native.existing_rule("com_github_google_benchmark"):
+    http_archive(
+        name = "com_github_google_benchmark",
+        sha256 = "3c6a165b6ecc948967a1ead710d4a181d7b0fbcaa183ef7ea84604994966221a",
+        strip_prefix = "benchmark-1.5.0",
+        urls = ["https://github.com/google/benchmark/archive/v1.5.0.tar.gz"],
+    )
+
   if not native.existing_rule("abseil"):
     http_archive(
         name = "abseil",
@@ -0,0 +1,384 @@
+#include "rhutil/curl/alloc.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <utility>
+
+#include "absl/base/optimization.h"
+#include "absl/base/thread_annotations.h"
+#include "absl/synchronization/mutex.h"
+
+namespace rhutil {
+namespace {
+
+// Steps of 16 bytes up to 128, then four classes per doubling up to 256KiB,
+// so that no allocation wastes more than a fifth of its block.
+constexpr int kNumClasses = 8 + 11 * 4;
+
+constexpr std::array<std::size_t, kNumClasses> MakeClassSizes() {
+  std::array<std::size_t, kNumClasses> sizes{};
+  int i = 0;
+  for (std::size_t size = 16; size <= 128; size += 16) sizes[i++] = size;
+  for (std::size_t base = 128; i < kNumClasses; base *= 2) {
+    for (int step = 1; step <= 4; ++step) sizes[i++] = base + base / 4 * step;
+  }
+  return sizes;
+}
+
+constexpr std::array<std::size_t, kNumClasses> kClassSizes = MakeClassSizes();
+static_assert(kClassSizes[kNumClasses - 1] == 256 << 10);
+
+// The size class of allocations served by malloc.
+constexpr int kLargeClass = kNumClasses;
+
+// Blocks of the smaller classes are carved from slabs of this size.
+constexpr std::size_t kSlabSize = 64 << 10;
+// Roughly how much each thread caches per size class.
+constexpr std::size_t kMaxCachedBytes = 64 << 10;
+
+// Precedes every allocation. Keeps what follows it 16-byte aligned, like
+// malloc.
+struct alignas(16) Header {
+  std::size_t size;
+  uint32_t size_class;
+};
+constexpr std::size_t kHeaderSize = sizeof(Header);
+static_assert(kHeaderSize == 16);
+
+// Free blocks are linked through their first word.
+struct FreeBlock {
+  FreeBlock *next;
+};
+
+struct alignas(64) CentralList {
+  absl::Mutex mu;
+  FreeBlock *head GUARDED_BY(mu) = nullptr;
+  uint64_t blocks GUARDED_BY(mu) = 0;
+  // Counts of threads without a cache, and of exited threads.
+  std::atomic<uint64_t> allocs{0};
+  std::atomic<uint64_t> frees{0};
+};
+
+struct ThreadCache {
+  struct Class {
+    FreeBlock *head = nullptr;
+    std::size_t count = 0;
+    // Written only by the owning thread, but read by GetCurlAllocStats.
+    std::atomic<uint64_t> allocs{0};
+    std::atomic<uint64_t> frees{0};
+  };
+  Class classes[kNumClasses];
+};
+
+struct Pool {
+  CentralList central[kNumClasses];
+  std::atomic<uint64_t> large_allocs{0};
+  std::atomic<uint64_t> large_frees{0};
+  std::atomic<uint64_t> live_bytes{0};
+  std::atomic<uint64_t> peak_bytes{0};
+
+  // Acquired before any CentralList::mu.
+  absl::Mutex caches_mu;
+  std::vector<ThreadCache*> caches GUARDED_BY(caches_mu);
+};
+
+Pool &GetPool() {
+  static auto *pool = new Pool;
+  return *pool;
+}
+
+int SizeClassFor(std::size_t size) {
+  if (size <= 128) return size == 0 ? 0 : (size - 1) / 16;
+  auto it = std::lower_bound(kClassSizes.begin(), kClassSizes.end(), size);
+  return it - kClassSizes.begin();
+}
+
+std::size_t BlockSize(int size_class) {
+  return kHeaderSize + kClassSizes[size_class];
+}
+
+// How many blocks a thread exchanges with the central list at once. A thread
+// caches at most twice this many.
+std::size_t BatchSize(int size_class) {
+  return std::clamp<std::size_t>(
+      kMaxCachedBytes / 2 / BlockSize(size_class), 1, 32);
+}
+
+void Increment(std::atomic<uint64_t> *counter) {
+  counter->store(counter->load(std::memory_order_relaxed) + 1,
+                 std::memory_order_relaxed);
+}
+
+void AddLive(Pool *pool, std::size_t size) {
+  const uint64_t live =
+      pool->live_bytes.fetch_add(size, std::memory_order_relaxed) + size;
+  uint64_t peak = pool->peak_bytes.load(std::memory_order_relaxed);
+  while (live > peak && !pool->peak_bytes.compare_exchange_weak(
+                            peak, live, std::memory_order_relaxed)) {}
+}
+
+void SubtractLive(Pool *pool, std::size_t size) {
+  pool->live_bytes.fetch_sub(size, std::memory_order_relaxed);
+}
+
+bool CarveSlabLocked(CentralList *list, int size_class)
+    EXCLUSIVE_LOCKS_REQUIRED(list->mu) {
+  const std::size_t block_size = BlockSize(size_class);
+  const std::size_t count = std::max<std::size_t>(1, kSlabSize / block_size);
+  char *slab = static_cast<char*>(std::malloc(block_size * count));
+  if (slab == nullptr) return false;
+  for (std::size_t i = count; i-- > 0;) {
+    auto *block = reinterpret_cast<FreeBlock*>(slab + i * block_size);
+    block->next = list->head;
+    list->head = block;
+  }
+  list->blocks += count;
+  return true;
+}
+
+// Moves up to n blocks from list onto *head, carving a slab if list is empty.
+// Returns how many were moved, which is 0 only if malloc failed.
+std::size_t TakeBlocks(CentralList *list, int size_class, std::size_t n,
+                       FreeBlock **head) {
+  absl::MutexLock lock(&list->mu);
+  if (list->head == nullptr && !CarveSlabLocked(list, size_class)) return 0;
+  std::size_t taken = 0;
+  for (; taken < n && list->head != nullptr; ++taken) {
+    FreeBlock *block = list->head;
+    list->head = block->next;
+    block->next = *head;
+    *head = block;
+  }
+  return taken;
+}
+
+// Returns the chain of blocks from head to tail to list.
+void ReturnBlocks(CentralList *list, FreeBlock *head, FreeBlock *tail) {
+  absl::MutexLock lock(&list->mu);
+  tail->next = list->head;
+  list->head = head;
+}
+
+thread_local ThreadCache *tls_cache = nullptr;
+// Set once the thread's cache has been returned, after which it allocates
+// straight from the central lists. libcurl may still free memory from the
+// destructors of other thread_locals.
+thread_local bool tls_cache_returned = false;
+
+// Returns the thread's cache to the pool when the thread exits.
+struct ThreadCacheReaper {
+  ~ThreadCacheReaper() {
+    ThreadCache *cache = std::exchange(tls_cache, nullptr);
+    tls_cache_returned = true;
+    if (cache == nullptr) return;
+    Pool &pool = GetPool();
+    absl::MutexLock lock(&pool.caches_mu);
+    pool.caches.erase(
+        std::find(pool.caches.begin(), pool.caches.end(), cache));
+    for (int i = 0; i < kNumClasses; ++i) {
+      ThreadCache::Class &cached = cache->classes[i];
+      CentralList &central = pool.central[i];
+      central.allocs.fetch_add(cached.allocs.load(std::memory_order_relaxed),
+                               std::memory_order_relaxed);
+      central.frees.fetch_add(cached.frees.load(std::memory_order_relaxed),
+                              std::memory_order_relaxed);
+      if (cached.head == nullptr) continue;
+      FreeBlock *tail = cached.head;
+      while (tail->next != nullptr) tail = tail->next;
+      ReturnBlocks(&central, cached.head, tail);
+    }
+    delete cache;
+  }
+};
+
+thread_local ThreadCacheReaper tls_reaper;
+
+// nullptr once the thread has started exiting.
+ThreadCache *GetThreadCache(Pool *pool) {
+  if (ABSL_PREDICT_TRUE(tls_cache != nullptr) || tls_cache_returned) {
+    return tls_cache;
+  }
+  // Constructs tls_reaper, so that it is destroyed when the thread exits.
+  static_cast<void>(&tls_reaper);
+  auto *cache = new ThreadCache;
+  {
+    absl::MutexLock lock(&pool->caches_mu);
+    pool->caches.push_back(cache);
+  }
+  tls_cache = cache;
+  return cache;
+}
+
+void *AllocateBlock(Pool *pool, int size_class) {
+  CentralList &central = pool->central[size_class];
+  ThreadCache *cache = GetThreadCache(pool);
+  if (cache == nullptr) {
+    FreeBlock *block = nullptr;
+    if (TakeBlocks(&central, size_class, 1, &block) == 0) return nullptr;
+    central.allocs.fetch_add(1, std::memory_order_relaxed);
+    return block;
+  }
+  ThreadCache::Class &cached = cache->classes[size_class];
+  if (cached.head == nullptr) {
+    cached.count += TakeBlocks(&central, size_class, BatchSize(size_class),
+                               &cached.head);
+    if (cached.head == nullptr) return nullptr;
+  }
+  FreeBlock *block = cached.head;
+  cached.head = block->next;
+  --cached.count;
+  Increment(&cached.allocs);
+  return block;
+}
+
+void ReleaseBlock(Pool *pool, void *ptr, int size_class) {
+  CentralList &central = pool->central[size_class];
+  auto *block = static_cast<FreeBlock*>(ptr);
+  ThreadCache *cache = GetThreadCache(pool);
+  if (cache == nullptr) {
+    central.frees.fetch_add(1, std::memory_order_relaxed);
+    ReturnBlocks(&central, block, block);
+    return;
+  }
+  ThreadCache::Class &cached = cache->classes[size_class];
+  block->next = cached.head;
+  cached.head = block;
+  ++cached.count;
+  Increment(&cached.frees);
+
+  const std::size_t batch = BatchSize(size_class);
+  if (cached.count <= 2 * batch) return;
+  FreeBlock *head = cached.head;
+  FreeBlock *tail = head;
+  for (std::size_t i = 1; i < batch; ++i) tail = tail->next;
+  cached.head = tail->next;
+  cached.count -= batch;
+  ReturnBlocks(&central, head, tail);
+}
+
+Header *HeaderOf(void *ptr) { return static_cast<Header*>(ptr) - 1; }
+
+void *Allocate(std::size_t size) {
+  Pool &pool = GetPool();
+  const int size_class = SizeClassFor(size);
+  Header *header;
+  if (size_class == kLargeClass) {
+    if (size > std::numeric_limits<std::size_t>::max() - kHeaderSize) {
+      return nullptr;
+    }
+    header = static_cast<Header*>(std::malloc(kHeaderSize + size));
+    if (header == nullptr) return nullptr;
+    pool.large_allocs.fetch_add(1, std::memory_order_relaxed);
+  } else {
+    header = static_cast<Header*>(AllocateBlock(&pool, size_class));
+    if (header == nullptr) return nullptr;
+  }
+  header->size = size;
+  header->size_class = size_class;
+  AddLive(&pool, size);
+  return header + 1;
+}
+
+void Free(void *ptr) {
+  if (ptr == nullptr) return;
+  Pool &pool = GetPool();
+  Header *header = HeaderOf(ptr);
+  SubtractLive(&pool, header->size);
+  if (header->size_class == kLargeClass) {
+    pool.large_frees.fetch_add(1, std::memory_order_relaxed);
+    std::free(header);
+  } else {
+    ReleaseBlock(&pool, header, header->size_class);
+  }
+}
+
+void *Reallocate(void *ptr, std::size_t size) {
+  if (ptr == nullptr) return Allocate(size);
+  Header *header = HeaderOf(ptr);
+  const int size_class = header->size_class;
+  if (SizeClassFor(size) != size_class) {
+    void *moved = Allocate(size);
+    if (moved == nullptr) return nullptr;
+    std::memcpy(moved, ptr, std::min(size, header->size));
+    Free(ptr);
+    return moved;
+  }
+
+  Pool &pool = GetPool();
+  const std::size_t old_size = header->size;
+  if (size_class == kLargeClass) {
+    if (size > std::numeric_limits<std::size_t>::max() - kHeaderSize) {
+      return nullptr;
+    }
+    header = static_cast<Header*>(std::realloc(header, kHeaderSize + size));
+    if (header == nullptr) return nullptr;
+  }
+  header->size = size;
+  AddLive(&pool, size);
+  SubtractLive(&pool, old_size);
+  return header + 1;
+}
+
+void *AllocateZeroed(std::size_t nmemb, std::size_t size) {
+  if (size != 0 && nmemb > std::numeric_limits<std::size_t>::max() / size) {
+    return nullptr;
+  }
+  void *ptr = Allocate(nmemb * size);
+  if (ptr != nullptr) std::memset(ptr, 0, nmemb * size);
+  return ptr;
+}
+
+char *Duplicate(const char *str) {
+  const std::size_t size = std::strlen(str) + 1;
+  auto *copy = static_cast<char*>(Allocate(size));
+  if (copy != nullptr) std::memcpy(copy, str, size);
+  return copy;
+}
+
+}  // namespace
+
+const CurlMemoryCallbacks &PooledCurlMemoryCallbacks() {
+  static const CurlMemoryCallbacks callbacks = {
+      &Allocate, &Free, &Reallocate, &Duplicate, &AllocateZeroed};
+  return callbacks;
+}
+
+Status CurlGlobalInitPooled() {
+  return CurlGlobalInit(PooledCurlMemoryCallbacks());
+}
+
+CurlAllocStats GetCurlAllocStats() {
+  Pool &pool = GetPool();
+  CurlAllocStats stats;
+  stats.size_classes.resize(kNumClasses);
+  absl::MutexLock lock(&pool.caches_mu);
+  for (int i = 0; i < kNumClasses; ++i) {
+    CurlAllocStats::SizeClass &size_class = stats.size_classes[i];
+    CentralList &central = pool.central[i];
+    size_class.size = kClassSizes[i];
+    size_class.allocs = central.allocs.load(std::memory_order_relaxed);
+    size_class.frees = central.frees.load(std::memory_order_relaxed);
+    for (const ThreadCache *cache : pool.caches) {
+      size_class.allocs +=
+          cache->classes[i].allocs.load(std::memory_order_relaxed);
+      size_class.frees +=
+          cache->classes[i].frees.load(std::memory_order_relaxed);
+    }
+    {
+      absl::MutexLock central_lock(&central.mu);
+      size_class.blocks = central.blocks;
+    }
+    stats.slab_bytes += size_class.blocks * BlockSize(i);
+  }
+  stats.large_allocs = pool.large_allocs.load(std::memory_order_relaxed);
+  stats.large_frees = pool.large_frees.load(std::memory_order_relaxed);
+  stats.live_bytes = pool.live_bytes.load(std::memory_order_relaxed);
+  stats.peak_bytes = pool.peak_bytes.load(std::memory_order_relaxed);
+  return stats;
+}
+
+}  // namespace rhutil
@@ -0,0 +1,55 @@
+#ifndef RHUTIL_CURL_ALLOC_H_
+#define RHUTIL_CURL_ALLOC_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "rhutil/status.h"
+#include "rhutil/curl/curl.h"
+
+namespace rhutil {
+
+// A size-class pooled allocator for libcurl. Each thread keeps a small cache
+// of free blocks per size class, exchanging batches of them with a shared
+// pool, so that libcurl's many small, short-lived allocations neither
+// contend on the system allocator nor fragment its heap. Blocks are carved
+// from slabs which are never returned to the system, so the pool's footprint
+// tracks libcurl's peak usage. Allocations larger than the largest size class
+// go to malloc.
+//
+// The callbacks for CurlGlobalInit. Thread-safe.
+const CurlMemoryCallbacks &PooledCurlMemoryCallbacks();
+
+// CurlGlobalInit(PooledCurlMemoryCallbacks()). Must be called before any
+// other threads are created, and before anything else initializes libcurl.
+Status CurlGlobalInitPooled();
+
+struct CurlAllocStats {
+  struct SizeClass {
+    // The largest allocation the class serves.
+    std::size_t size = 0;
+    uint64_t allocs = 0;
+    uint64_t frees = 0;
+    // Blocks carved from slabs so far. Those not live are cached.
+    uint64_t blocks = 0;
+  };
+
+  std::vector<SizeClass> size_classes;
+  // Allocations served by malloc.
+  uint64_t large_allocs = 0;
+  uint64_t large_frees = 0;
+  // Bytes libcurl asked for and has not freed, and the most there have been.
+  uint64_t live_bytes = 0;
+  uint64_t peak_bytes = 0;
+  // Bytes of slabs taken from the system.
+  uint64_t slab_bytes = 0;
+};
+
+// The pooled allocator's counters. While other threads are allocating they
+// are not a consistent snapshot, though each is accurate.
+CurlAllocStats GetCurlAllocStats();
+
+}  // namespace rhutil
+
+#endif  // RHUTIL_CURL_ALLOC_H_
@@ -0,0 +1,129 @@
+#include "rhutil/curl/batch.h"
+
+#include <algorithm>
+#include <utility>
+
+#include "absl/time/time.h"
+
+namespace rhutil {
+
+CurlBatch::CurlBatch(absl::Span<const BatchRequest> requests)
+  : CurlBatch(requests, Options()) {}
+
+CurlBatch::CurlBatch(absl::Span<const BatchRequest> requests,
+                     Options options)
+  : requests_(requests), options_(std::move(options)) {
+  if (options_.http2) {
+    CHECK_OK(multi_.EnableMultiplexing(options_.max_host_connections));
+  } else {
+    CHECK_OK(CurlMultiSetopt(multi_.ptr(), CURLMOPT_MAX_HOST_CONNECTIONS,
+                             options_.max_host_connections));
+  }
+  const std::size_t concurrency = std::min<std::size_t>(
+      std::max(options_.max_concurrency, 1), requests_.size());
+  for (std::size_t i = 0; i < concurrency; ++i) {
+    transfers_.push_back(std::make_unique<Transfer>());
+    free_transfers_.push_back(transfers_.back().get());
+  }
+}
+
+bool CurlBatch::Next(BatchResult *result) {
+  while (ready_.empty()) {
+    Fill();
+    if (!ready_.empty()) break;
+    if (multi_.empty()) return false;
+    Status status = multi_.Poll(absl::InfiniteDuration());
+    if (!status.ok()) FailAll(status);
+  }
+  *result = std::move(ready_.front());
+  ready_.pop_front();
+  return true;
+}
+
+void CurlBatch::Run(const std::function<void(BatchResult)> &done) {
+  BatchResult result;
+  while (Next(&result)) done(std::move(result));
+}
+
+void CurlBatch::Fill() {
+  while (next_request_ < requests_.size() && !free_transfers_.empty()) {
+    Transfer *transfer = free_transfers_.back();
+    free_transfers_.pop_back();
+    transfer->index = next_request_++;
+    transfer->body.clear();
+
+    std::unique_ptr<CURL, CurlHandleDeleter> handle;
+    if (idle_handles_.empty()) {
+      handle = CurlEasyInit();
+    } else {
+      handle = std::move(idle_handles_.back());
+      idle_handles_.pop_back();
+    }
+    CURL *ptr = handle.get();
+    Status status = Configure(ptr, transfer);
+    if (status.ok()) {
+      status = multi_.Add(std::move(handle), [this, transfer](
+          std::unique_ptr<CURL, CurlHandleDeleter> handle, Status status) {
+        Finish(std::move(handle), transfer, std::move(status));
+      });
+    }
+    if (status.ok()) {
+      transfer->handle = ptr;
+      continue;
+    }
+    ready_.push_back({transfer->index, std::move(status)});
+    free_transfers_.push_back(transfer);
+    if (handle) Recycle(std::move(handle));
+  }
+}
+
+Status CurlBatch::Configure(CURL *handle, Transfer *transfer) const {
+  const BatchRequest &request = requests_[transfer->index];
+  RETURN_IF_ERROR(CurlEasySetopt(handle, CURLOPT_URL, request.url.c_str()));
+  if (options_.share != nullptr) {
+    RETURN_IF_ERROR(
+        CurlEasySetopt(handle, CURLOPT_SHARE, options_.share->ptr()));
+  }
+  if (options_.http2) RETURN_IF_ERROR(CurlEasyEnableHTTP2(handle));
+  if (request.headers) RETURN_IF_ERROR(request.headers->Apply(handle));
+  if (options_.configure) RETURN_IF_ERROR(options_.configure(handle));
+  if (request.configure) RETURN_IF_ERROR(request.configure(handle));
+  return CurlEasySetWriteSink(handle, &transfer->sink);
+}
+
+void CurlBatch::Finish(std::unique_ptr<CURL, CurlHandleDeleter> handle,
+                       Transfer *transfer, Status status) {
+  BatchResponse response;
+  status.Update(CurlEasyGetInfo(handle.get(), CURLINFO_RESPONSE_CODE,
+                                &response.response_code));
+  if (status.ok()) {
+    response.body = std::move(transfer->body);
+    ready_.push_back({transfer->index, std::move(response)});
+  } else {
+    ready_.push_back({transfer->index, std::move(status)});
+  }
+  transfer->handle = nullptr;
+  free_transfers_.push_back(transfer);
+  Recycle(std::move(handle));
+}
+
+void CurlBatch::Recycle(std::unique_ptr<CURL, CurlHandleDeleter> handle) {
+  CurlEasyReset(handle.get());
+  idle_handles_.push_back(std::move(handle));
+}
+
+void CurlBatch::FailAll(const Status &status) {
+  for (const auto &transfer : transfers_) {
+    if (transfer->handle == nullptr) continue;
+    auto handle = multi_.Remove(transfer->handle);
+    if (handle.ok()) Recycle(std::move(handle).ValueOrDie());
+    ready_.push_back({transfer->index, status});
+    transfer->handle = nullptr;
+    free_transfers_.push_back(transfer.get());
+  }
+  for (; next_request_ < requests_.size(); ++next_request_) {
+    ready_.push_back({next_request_, status});
+  }
+}
+
+}  // namespace rhutil
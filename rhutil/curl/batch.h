@@ -0,0 +1,110 @@
+#ifndef RHUTIL_CURL_BATCH_H_
+#define RHUTIL_CURL_BATCH_H_
+
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "rhutil/status.h"
+#include "rhutil/curl/curl.h"
+#include "rhutil/curl/headers.h"
+#include "rhutil/curl/multi.h"
+#include "rhutil/curl/sinks.h"
+#include "absl/types/span.h"
+
+namespace rhutil {
+
+struct BatchRequest {
+  std::string url;
+  // Optional.
+  std::shared_ptr<const CurlHeaderSet> headers;
+  // If set, called on the handle before the transfer starts, e.g. to change
+  // the method or set a timeout. It must not set a write callback.
+  std::function<Status(CURL*)> configure;
+};
+
+struct BatchResponse {
+  long response_code = 0;
+  std::string body;
+};
+
+struct BatchResult {
+  // Of the request in the batch.
+  std::size_t index = 0;
+  StatusOr<BatchResponse> response;
+};
+
+// Runs many independent requests concurrently on one CurlMulti, so that they
+// share its connections, and yields their results in the order they finish.
+// Handles are reused from one request to the next.
+//
+// This class is not thread-safe. Transfers only make progress inside Next
+// (or Run).
+class CurlBatch {
+ public:
+  struct Options {
+    // Transfers in flight at once.
+    int max_concurrency = 64;
+    // Connections per host, or 0 for no limit.
+    long max_host_connections = 0;
+    // Negotiates HTTP/2 for https URLs, multiplexing requests to the same
+    // host over one connection.
+    bool http2 = false;
+    // If set, handles use it, so that DNS results and connections (whichever
+    // the share is set up to share) outlive the batch. Not owned.
+    const ThreadSafeCurlShare *share = nullptr;
+    // If set, called on every handle before each request's own configure.
+    std::function<Status(CURL*)> configure;
+  };
+
+  // requests must outlive the batch.
+  explicit CurlBatch(absl::Span<const BatchRequest> requests);
+  CurlBatch(absl::Span<const BatchRequest> requests, Options options);
+
+  CurlBatch(const CurlBatch &) = delete;
+  CurlBatch &operator=(const CurlBatch &) = delete;
+
+  // Waits for the next request to finish and sets *result, or returns false
+  // once every request's result has been returned. Requests which fail,
+  // including with HTTP errors, still return a result (see
+  // CurlEasyResultToStatus). If the event loop itself fails, every
+  // unfinished request fails with its error.
+  bool Next(BatchResult *result);
+
+  // Calls done with every result as it arrives.
+  void Run(const std::function<void(BatchResult)> &done);
+
+ private:
+  struct Transfer {
+    std::size_t index = 0;
+    // nullptr unless in flight.
+    CURL *handle = nullptr;
+    std::string body;
+    StringSink sink{&body};
+  };
+
+  // Starts requests until max_concurrency are in flight.
+  void Fill();
+  Status Configure(CURL *handle, Transfer *transfer) const;
+  void Finish(std::unique_ptr<CURL, CurlHandleDeleter> handle,
+              Transfer *transfer, Status status);
+  void Recycle(std::unique_ptr<CURL, CurlHandleDeleter> handle);
+  void FailAll(const Status &status);
+
+  const absl::Span<const BatchRequest> requests_;
+  const Options options_;
+  std::size_t next_request_ = 0;
+
+  CurlMulti multi_;
+  std::vector<std::unique_ptr<Transfer>> transfers_;
+  std::vector<Transfer*> free_transfers_;
+  std::vector<std::unique_ptr<CURL, CurlHandleDeleter>> idle_handles_;
+  std::deque<BatchResult> ready_;
+};
+
+}  // namespace rhutil
+
+#endif  // RHUTIL_CURL_BATCH_H_
@@ -0,0 +1,505 @@
+#include "rhutil/curl/cache.h"
+
+#include <algorithm>
+
+#include "rhutil/file.h"
+#include "rhutil/cleanup.h"
+#include "rhutil/curl/sinks.h"
+#include "absl/strings/ascii.h"
+#include "absl/strings/match.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_format.h"
+#include "absl/strings/str_split.h"
+#include "absl/time/clock.h"
+
+namespace rhutil {
+namespace {
+
+using Headers = std::vector<std::pair<std::string, std::string>>;
+
+constexpr std::string_view kDiskMagic = "rhutil-http-cache-1\n";
+constexpr absl::Duration kMaxHeuristicLifetime = absl::Hours(24);
+
+struct CacheControl {
+  bool no_store = false;
+  bool no_cache = false;
+  bool has_max_age = false;
+  absl::Duration max_age;
+};
+
+size_t HeaderCallback(char *ptr, size_t, size_t nitems, void *userdata) {
+  auto *headers = reinterpret_cast<Headers*>(userdata);
+  std::string_view line(ptr, nitems);
+  // Each response (e.g. after a redirect) starts with a new status line.
+  if (absl::StartsWith(line, "HTTP/")) {
+    headers->clear();
+    return nitems;
+  }
+  auto colon = line.find(':');
+  if (colon == std::string_view::npos) return nitems;
+  headers->emplace_back(
+      absl::AsciiStrToLower(absl::StripAsciiWhitespace(line.substr(0, colon))),
+      std::string(absl::StripAsciiWhitespace(line.substr(colon + 1))));
+  return nitems;
+}
+
+const std::string *FindHeader(const Headers &headers, std::string_view name) {
+  for (const auto &header : headers) {
+    if (header.first == name) return &header.second;
+  }
+  return nullptr;
+}
+
+std::string_view FindRequestHeader(
+    absl::Span<const std::string_view> request_headers, std::string_view name) {
+  for (std::string_view line : request_headers) {
+    auto colon = line.find(':');
+    if (colon == std::string_view::npos) continue;
+    if (absl::EqualsIgnoreCase(
+            absl::StripAsciiWhitespace(line.substr(0, colon)), name)) {
+      return absl::StripAsciiWhitespace(line.substr(colon + 1));
+    }
+  }
+  return {};
+}
+
+CacheControl ParseCacheControl(const Headers &headers) {
+  CacheControl cc;
+  for (const auto &header : headers) {
+    if (header.first != "cache-control") continue;
+    for (std::string_view directive : absl::StrSplit(header.second, ',')) {
+      directive = absl::StripAsciiWhitespace(directive);
+      std::string_view value;
+      auto eq = directive.find('=');
+      if (eq != std::string_view::npos) {
+        value = absl::StripAsciiWhitespace(directive.substr(eq + 1));
+        directive = absl::StripAsciiWhitespace(directive.substr(0, eq));
+      }
+      if (absl::EqualsIgnoreCase(directive, "no-store")) {
+        cc.no_store = true;
+      } else if (absl::EqualsIgnoreCase(directive, "no-cache")) {
+        cc.no_cache = true;
+      } else if (absl::EqualsIgnoreCase(directive, "max-age")) {
+        int64_t seconds;
+        if (absl::SimpleAtoi(absl::StripPrefix(value, "\""), &seconds)) {
+          cc.has_max_age = true;
+          cc.max_age = absl::Seconds(std::max<int64_t>(seconds, 0));
+        }
+      }
+    }
+  }
+  return cc;
+}
+
+// Returns the lowercased header names in Vary, or false if the response
+// varies on something other than request headers (Vary: *).
+bool ParseVary(const Headers &headers, std::vector<std::string> *vary) {
+  vary->clear();
+  for (const auto &header : headers) {
+    if (header.first != "vary") continue;
+    for (std::string_view name : absl::StrSplit(header.second, ',')) {
+      name = absl::StripAsciiWhitespace(name);
+      if (name.empty()) continue;
+      if (name == "*") return false;
+      vary->push_back(absl::AsciiStrToLower(name));
+    }
+  }
+  std::sort(vary->begin(), vary->end());
+  vary->erase(std::unique(vary->begin(), vary->end()), vary->end());
+  return true;
+}
+
+// Keys are the URL, then a line per Vary header. URLs never contain a LF,
+// which CurlURL would have percent-encoded.
+std::string CacheKey(const std::string &url,
+                     const std::vector<std::string> &vary,
+                     absl::Span<const std::string_view> request_headers) {
+  std::string key = url;
+  for (const std::string &name : vary) {
+    absl::StrAppend(&key, "\n", name, ": ",
+                    FindRequestHeader(request_headers, name));
+  }
+  return key;
+}
+
+std::string_view CacheKeyURL(std::string_view key) {
+  return key.substr(0, key.find('\n'));
+}
+
+std::size_t VarySize(const std::string &url,
+                     const std::vector<std::string> &vary) {
+  std::size_t size = url.size();
+  for (const std::string &name : vary) size += name.size();
+  return size;
+}
+
+absl::Time ParseHTTPDate(const std::string *value, absl::Time fallback) {
+  if (value == nullptr) return fallback;
+  time_t t = curl_getdate(value->c_str(), nullptr);
+  if (t == -1) return fallback;
+  return absl::FromTimeT(t);
+}
+
+// FNV-1a, which unlike absl::Hash is stable across processes.
+uint64_t StableHash(std::string_view data) {
+  uint64_t hash = 14695981039346656037ull;
+  for (char c : data) {
+    hash ^= static_cast<unsigned char>(c);
+    hash *= 1099511628211ull;
+  }
+  return hash;
+}
+
+void AppendField(std::string *out, std::string_view field) {
+  absl::StrAppend(out, field.size(), "\n", field);
+}
+
+bool ConsumeField(std::string_view *in, std::string_view *field) {
+  auto nl = in->find('\n');
+  if (nl == std::string_view::npos) return false;
+  std::size_t size;
+  if (!absl::SimpleAtoi(in->substr(0, nl), &size)) return false;
+  in->remove_prefix(nl + 1);
+  if (in->size() < size) return false;
+  *field = in->substr(0, size);
+  in->remove_prefix(size);
+  return true;
+}
+
+template <typename Int>
+bool ConsumeIntField(std::string_view *in, Int *value) {
+  std::string_view field;
+  return ConsumeField(in, &field) && absl::SimpleAtoi(field, value);
+}
+
+}  // namespace
+
+bool HttpCache::Entry::IsFresh(absl::Time now) const {
+  return !no_cache && now - date < lifetime;
+}
+
+std::size_t HttpCache::Entry::Size() const {
+  std::size_t size = sizeof(Entry) + body->size() + etag.size() +
+      last_modified.size();
+  for (const auto &header : headers) {
+    size += header.first.size() + header.second.size();
+  }
+  return size;
+}
+
+HttpCache::HttpCache() : HttpCache(Options()) {}
+
+HttpCache::HttpCache(Options options) : options_(std::move(options)) {}
+
+bool HttpCache::FillEntry(absl::Time received, Entry *entry) {
+  const Headers &headers = entry->headers;
+  CacheControl cc = ParseCacheControl(headers);
+  if (cc.no_store) return false;
+
+  const absl::Time date = ParseHTTPDate(FindHeader(headers, "date"), received);
+  absl::Duration age = std::max(received - date, absl::ZeroDuration());
+  if (const std::string *age_header = FindHeader(headers, "age")) {
+    int64_t seconds;
+    if (absl::SimpleAtoi(*age_header, &seconds)) {
+      age = std::max(age, absl::Seconds(seconds));
+    }
+  }
+  entry->date = received - age;
+
+  const std::string *etag = FindHeader(headers, "etag");
+  entry->etag = etag != nullptr ? *etag : "";
+  const std::string *last_modified = FindHeader(headers, "last-modified");
+  entry->last_modified = last_modified != nullptr ? *last_modified : "";
+  entry->no_cache = cc.no_cache;
+
+  if (cc.has_max_age) {
+    entry->lifetime = cc.max_age;
+  } else if (const std::string *expires = FindHeader(headers, "expires")) {
+    // An invalid Expires means already expired.
+    entry->lifetime = ParseHTTPDate(expires, date) - date;
+  } else if (last_modified != nullptr) {
+    entry->lifetime = std::min(
+        kMaxHeuristicLifetime,
+        (date - ParseHTTPDate(last_modified, date)) / 10);
+  } else {
+    entry->lifetime = absl::ZeroDuration();
+  }
+  // There is no point keeping a response which can neither be served nor
+  // revalidated.
+  return entry->lifetime > absl::ZeroDuration() || !entry->etag.empty() ||
+      !entry->last_modified.empty();
+}
+
+StatusOr<HttpCache::Response> HttpCache::Fetch(
+    CURL *handle, const CurlURL &url,
+    absl::Span<const std::string_view> request_headers) {
+  ASSIGN_OR_RETURN(auto url_str, url.Get(CURLUPART_URL));
+  const std::string url_key(url_str.get());
+  const std::vector<std::string> cached_vary = VaryFor(url_key);
+  const std::string key = CacheKey(url_key, cached_vary, request_headers);
+
+  Entry cached;
+  const bool have_cached = Lookup(url_key, cached_vary, key, &cached);
+  if (have_cached && cached.IsFresh(absl::Now())) {
+    absl::MutexLock lock(&mu_);
+    ++stats_.hits;
+    return Response{200, cached.body, cached.headers, true, false};
+  }
+
+  std::vector<std::string> lines(request_headers.begin(),
+                                 request_headers.end());
+  if (have_cached && !cached.etag.empty()) {
+    lines.push_back(absl::StrCat("If-None-Match: ", cached.etag));
+  }
+  if (have_cached && !cached.last_modified.empty()) {
+    lines.push_back(absl::StrCat("If-Modified-Since: ", cached.last_modified));
+  }
+  std::vector<std::string_view> line_views(lines.begin(), lines.end());
+  auto header_list = NewCurlSList(line_views);
+
+  auto body = std::make_shared<std::string>();
+  StringSink sink(body.get());
+  Headers headers;
+  Cleanup unset_pointers([handle] {
+    CurlEasySetopt(handle, CURLOPT_HTTPHEADER,
+                   static_cast<curl_slist*>(nullptr)).IgnoreError();
+    CurlEasySetopt(handle, CURLOPT_HEADERFUNCTION,
+                   static_cast<curl_write_callback>(nullptr)).IgnoreError();
+    CurlEasySetopt(handle, CURLOPT_HEADERDATA,
+                   static_cast<void*>(nullptr)).IgnoreError();
+  });
+  RETURN_IF_ERROR(CurlEasySetopt(handle, CURLOPT_HTTPGET, 1L));
+  RETURN_IF_ERROR(CurlEasySetopt(handle, CURLOPT_URL, url_str.get()));
+  RETURN_IF_ERROR(
+      CurlEasySetopt(handle, CURLOPT_HTTPHEADER, header_list.get()));
+  RETURN_IF_ERROR(CurlEasySetopt(handle, CURLOPT_HEADERFUNCTION,
+                                 &HeaderCallback));
+  RETURN_IF_ERROR(CurlEasySetopt(handle, CURLOPT_HEADERDATA, &headers));
+  RETURN_IF_ERROR(CurlEasySetWriteSink(handle, &sink));
+
+  Status status = CurlEasyPerform(handle);
+  long response_code = 0;
+  RETURN_IF_ERROR(
+      CurlEasyGetInfo(handle, CURLINFO_RESPONSE_CODE, &response_code));
+  const absl::Time received = absl::Now();
+
+  if (have_cached && response_code == 304) {
+    // A 304 carries updated metadata for the stored response.
+    for (const auto &header : headers) {
+      auto replaced = [&](const auto &h) { return h.first == header.first; };
+      cached.headers.erase(std::remove_if(cached.headers.begin(),
+                                          cached.headers.end(), replaced),
+                           cached.headers.end());
+    }
+    cached.headers.insert(cached.headers.end(), headers.begin(),
+                          headers.end());
+    std::vector<std::string> vary;
+    if (FillEntry(received, &cached) && ParseVary(cached.headers, &vary)) {
+      Store(url_key, vary, CacheKey(url_key, vary, request_headers), cached);
+    }
+    {
+      absl::MutexLock lock(&mu_);
+      ++stats_.revalidations;
+    }
+    return Response{200, cached.body, cached.headers, true, true};
+  }
+  {
+    absl::MutexLock lock(&mu_);
+    ++stats_.misses;
+  }
+  RETURN_IF_ERROR(status);
+
+  Entry entry;
+  entry.body = body;
+  entry.headers = headers;
+  std::vector<std::string> vary;
+  if (response_code == 200 && FillEntry(received, &entry) &&
+      ParseVary(entry.headers, &vary)) {
+    Store(url_key, vary, CacheKey(url_key, vary, request_headers), entry);
+  }
+  return Response{response_code, std::move(body), std::move(headers), false,
+                  false};
+}
+
+HttpCache::Stats HttpCache::GetStats() const {
+  absl::MutexLock lock(&mu_);
+  return stats_;
+}
+
+std::vector<std::string> HttpCache::VaryFor(const std::string &url) {
+  {
+    absl::MutexLock lock(&mu_);
+    auto it = vary_.find(url);
+    if (it != vary_.end()) return it->second.names;
+  }
+  // Nothing is remembered for a miss, which is kept in memory only once a
+  // response for url is.
+  std::vector<std::string> vary;
+  if (options_.disk_directory.empty()) return vary;
+  auto data = ReadFileToString(DiskPath(url, ".vary"));
+  if (!data.ok()) return vary;
+  std::string_view in = data.ValueOrDie();
+  std::string_view field;
+  if (absl::ConsumePrefix(&in, kDiskMagic) && ConsumeField(&in, &field) &&
+      field == url) {
+    while (ConsumeField(&in, &field)) vary.emplace_back(field);
+  }
+  return vary;
+}
+
+bool HttpCache::Lookup(const std::string &url,
+                       const std::vector<std::string> &vary,
+                       const std::string &key, Entry *entry) {
+  {
+    absl::MutexLock lock(&mu_);
+    auto it = entries_.find(key);
+    if (it != entries_.end()) {
+      lru_.splice(lru_.begin(), lru_, it->second.lru);
+      *entry = it->second.entry;
+      return true;
+    }
+  }
+  if (options_.disk_directory.empty()) return false;
+  auto entry_or = ReadFromDisk(key);
+  if (!entry_or.ok()) return false;
+  *entry = std::move(entry_or).ValueOrDie();
+  absl::MutexLock lock(&mu_);
+  ++stats_.disk_reads;
+  if (entry->Size() <= options_.max_memory_bytes) {
+    InsertLocked(url, vary, key, *entry);
+  }
+  return true;
+}
+
+void HttpCache::Store(const std::string &url,
+                      const std::vector<std::string> &vary,
+                      const std::string &key, const Entry &entry) {
+  bool vary_changed;
+  {
+    absl::MutexLock lock(&mu_);
+    auto it = vary_.find(url);
+    vary_changed = it == vary_.end() || it->second.names != vary;
+    if (entry.Size() <= options_.max_memory_bytes) {
+      InsertLocked(url, vary, key, entry);
+    } else if (it != vary_.end()) {
+      SetVaryLocked(url, vary, &it->second);
+    }
+  }
+  if (options_.disk_directory.empty()) return;
+  // Failing to persist a response does not fail the request.
+  WriteToDisk(key, entry).IgnoreError();
+  if (vary_changed) {
+    std::string data(kDiskMagic);
+    AppendField(&data, url);
+    for (const std::string &name : vary) AppendField(&data, name);
+    WriteFileAtomically(DiskPath(url, ".vary"), data).IgnoreError();
+  }
+}
+
+void HttpCache::InsertLocked(const std::string &url,
+                             const std::vector<std::string> &vary,
+                             const std::string &key, Entry entry) {
+  auto it = entries_.find(key);
+  if (it != entries_.end()) EraseLocked(it);
+  VaryEntry &vary_entry = vary_[url];
+  SetVaryLocked(url, vary, &vary_entry);
+  ++vary_entry.refs;
+  stats_.memory_bytes += entry.Size();
+  lru_.push_front(key);
+  entries_.emplace(key, MemoryEntry{std::move(entry), lru_.begin()});
+  while (stats_.memory_bytes > options_.max_memory_bytes && !lru_.empty()) {
+    EraseLocked(entries_.find(lru_.back()));
+    ++stats_.evictions;
+  }
+  stats_.entries = entries_.size();
+}
+
+void HttpCache::EraseLocked(
+    absl::flat_hash_map<std::string, MemoryEntry>::iterator it) {
+  stats_.memory_bytes -= it->second.entry.Size();
+  lru_.erase(it->second.lru);
+  auto vary_it = vary_.find(CacheKeyURL(it->first));
+  if (--vary_it->second.refs == 0) {
+    stats_.memory_bytes -= VarySize(vary_it->first, vary_it->second.names);
+    vary_.erase(vary_it);
+  }
+  entries_.erase(it);
+}
+
+void HttpCache::SetVaryLocked(const std::string &url,
+                              const std::vector<std::string> &vary,
+                              VaryEntry *vary_entry) {
+  // A new VaryEntry has no names, and nothing charged for them.
+  if (vary_entry->refs > 0) {
+    stats_.memory_bytes -= VarySize(url, vary_entry->names);
+  }
+  vary_entry->names = vary;
+  stats_.memory_bytes += VarySize(url, vary_entry->names);
+}
+
+std::string HttpCache::DiskPath(std::string_view key,
+                                std::string_view suffix) const {
+  return absl::StrFormat("%s/%016x%s", options_.disk_directory,
+                         StableHash(key), suffix);
+}
+
+Status HttpCache::WriteToDisk(const std::string &key,
+                              const Entry &entry) const {
+  std::string data(kDiskMagic);
+  AppendField(&data, key);
+  AppendField(&data, entry.etag);
+  AppendField(&data, entry.last_modified);
+  AppendField(&data, absl::StrCat(absl::ToUnixMicros(entry.date)));
+  AppendField(&data, absl::StrCat(absl::ToInt64Microseconds(entry.lifetime)));
+  AppendField(&data, entry.no_cache ? "1" : "0");
+  AppendField(&data, absl::StrCat(entry.headers.size()));
+  for (const auto &header : entry.headers) {
+    AppendField(&data, header.first);
+    AppendField(&data, header.second);
+  }
+  AppendField(&data, *entry.body);
+  return WriteFileAtomically(DiskPath(key, ".entry"), data);
+}
+
+StatusOr<HttpCache::Entry> HttpCache::ReadFromDisk(
+    const std::string &key) const {
+  const std::string path = DiskPath(key, ".entry");
+  ASSIGN_OR_RETURN(std::string data, ReadFileToString(path));
+  std::string_view in = data;
+  std::string_view stored_key, etag, last_modified, body;
+  int64_t date_micros, lifetime_micros, no_cache;
+  std::size_t header_count;
+  if (!absl::ConsumePrefix(&in, kDiskMagic) ||
+      !ConsumeField(&in, &stored_key) || !ConsumeField(&in, &etag) ||
+      !ConsumeField(&in, &last_modified) ||
+      !ConsumeIntField(&in, &date_micros) ||
+      !ConsumeIntField(&in, &lifetime_micros) ||
+      !ConsumeIntField(&in, &no_cache) ||
+      !ConsumeIntField(&in, &header_count)) {
+    return DataLossError(absl::StrCat("Corrupt cache entry ", path));
+  }
+  // A different key with the same hash.
+  if (stored_key != key) return NotFoundError(key);
+
+  Entry entry;
+  entry.etag = std::string(etag);
+  entry.last_modified = std::string(last_modified);
+  entry.date = absl::FromUnixMicros(date_micros);
+  entry.lifetime = absl::Microseconds(lifetime_micros);
+  entry.no_cache = no_cache != 0;
+  for (std::size_t i = 0; i < header_count; ++i) {
+    std::string_view name, value;
+    if (!ConsumeField(&in, &name) || !ConsumeField(&in, &value)) {
+      return DataLossError(absl::StrCat("Corrupt cache entry ", path));
+    }
+    entry.headers.emplace_back(name, value);
+  }
+  if (!ConsumeField(&in, &body)) {
+    return DataLossError(absl::StrCat("Corrupt cache entry ", path));
+  }
+  entry.body = std::make_shared<const std::string>(body);
+  return entry;
+}
+
+}  // namespace rhutil
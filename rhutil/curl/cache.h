@@ -0,0 +1,155 @@
+#ifndef RHUTIL_CURL_CACHE_H_
+#define RHUTIL_CURL_CACHE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "rhutil/status.h"
+#include "rhutil/curl/curl.h"
+#include "curl/curl.h"
+#include "absl/time/time.h"
+#include "absl/types/span.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/container/flat_hash_map.h"
+
+namespace rhutil {
+
+// A thread-safe private HTTP cache for GET requests, with an in-memory LRU
+// and an optional on-disk tier.
+//
+// Responses are keyed by URL plus the values of the request headers named by
+// the response's Vary header. Freshness follows Cache-Control (max-age,
+// no-cache, no-store), Expires, Age and, failing those, the usual heuristic
+// of 10% of the time since Last-Modified. Stale responses are revalidated with
+// If-None-Match and If-Modified-Since, and a 304 is served from the cache.
+// Only 200 responses are stored.
+class HttpCache {
+ public:
+  struct Options {
+    // Memory used by cached bodies and headers, and by the Vary header names
+    // kept for each URL with a response in memory. Responses larger than
+    // this are only stored on disk.
+    std::size_t max_memory_bytes = 64 << 20;
+    // If set, every stored response is also written to a file in this
+    // (existing) directory, and responses evicted from memory or stored by a
+    // previous process are read back from it. The directory is not pruned.
+    std::string disk_directory;
+  };
+
+  struct Response {
+    long response_code = 0;
+    // Shared with the cache, so hits do not copy the body.
+    std::shared_ptr<const std::string> body;
+    // In the order received, with names lowercased.
+    std::vector<std::pair<std::string, std::string>> headers;
+    // Whether the body was served from the cache, and if so whether the
+    // server had to confirm it first.
+    bool from_cache = false;
+    bool revalidated = false;
+  };
+
+  struct Stats {
+    // Fresh responses served without contacting the server.
+    uint64_t hits = 0;
+    // Stale responses confirmed by a 304.
+    uint64_t revalidations = 0;
+    uint64_t misses = 0;
+    uint64_t disk_reads = 0;
+    uint64_t evictions = 0;
+    std::size_t entries = 0;
+    std::size_t memory_bytes = 0;
+  };
+
+  HttpCache();
+  explicit HttpCache(Options options);
+
+  HttpCache(const HttpCache &) = delete;
+  HttpCache &operator=(const HttpCache &) = delete;
+
+  // GETs url through the cache using handle, which must have been created by
+  // CurlEasyInit and may carry any other options (timeouts, a share, etc).
+  // request_headers are "Name: value" lines sent with the request.
+  //
+  // Fetch sets the URL, HTTP headers, write sink and header function of
+  // handle, so those must be set again before it is used for anything else.
+  StatusOr<Response> Fetch(
+      CURL *handle, const CurlURL &url,
+      absl::Span<const std::string_view> request_headers = {});
+
+  Stats GetStats() const;
+
+ private:
+  struct Entry {
+    std::shared_ptr<const std::string> body;
+    std::vector<std::pair<std::string, std::string>> headers;
+    std::string etag;
+    std::string last_modified;
+    // When the response was generated, i.e. when it was received less its
+    // Age.
+    absl::Time date;
+    absl::Duration lifetime;
+    bool no_cache = false;
+
+    bool IsFresh(absl::Time now) const;
+    std::size_t Size() const;
+  };
+
+  struct MemoryEntry {
+    Entry entry;
+    std::list<std::string>::iterator lru;
+  };
+
+  // The request headers the responses for a URL vary on, kept in memory
+  // while any of those responses is.
+  struct VaryEntry {
+    std::vector<std::string> names;
+    // The number of entries_ for the URL.
+    std::size_t refs = 0;
+  };
+
+  // Fills in everything but the body of an entry from its headers. Returns
+  // false if the response must not be stored.
+  static bool FillEntry(absl::Time received, Entry *entry);
+
+  // Returns the names of the request headers the cached responses for url
+  // vary on, reading them from disk if necessary.
+  std::vector<std::string> VaryFor(const std::string &url);
+  bool Lookup(const std::string &url, const std::vector<std::string> &vary,
+              const std::string &key, Entry *entry);
+  void Store(const std::string &url, const std::vector<std::string> &vary,
+             const std::string &key, const Entry &entry);
+  void InsertLocked(const std::string &url,
+                    const std::vector<std::string> &vary,
+                    const std::string &key, Entry entry)
+      EXCLUSIVE_LOCKS_REQUIRED(mu_);
+  void EraseLocked(
+      absl::flat_hash_map<std::string, MemoryEntry>::iterator it)
+      EXCLUSIVE_LOCKS_REQUIRED(mu_);
+  void SetVaryLocked(const std::string &url,
+                     const std::vector<std::string> &vary,
+                     VaryEntry *vary_entry) EXCLUSIVE_LOCKS_REQUIRED(mu_);
+
+  std::string DiskPath(std::string_view key, std::string_view suffix) const;
+  Status WriteToDisk(const std::string &key, const Entry &entry) const;
+  StatusOr<Entry> ReadFromDisk(const std::string &key) const;
+
+  const Options options_;
+
+  mutable absl::Mutex mu_;
+  // Most recently used first.
+  std::list<std::string> lru_ GUARDED_BY(mu_);
+  absl::flat_hash_map<std::string, MemoryEntry> entries_ GUARDED_BY(mu_);
+  // Keyed by URL.
+  absl::flat_hash_map<std::string, VaryEntry> vary_ GUARDED_BY(mu_);
+  Stats stats_ GUARDED_BY(mu_);
+};
+
+}  // namespace rhutil
+
+#endif  // RHUTIL_CURL_CACHE_H_
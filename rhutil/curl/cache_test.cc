@@ -0,0 +1,211 @@
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "rhutil/curl/cache.h"
+#include "rhutil/curl/curl.h"
+#include "rhutil/curl/testing/loopback_server.h"
+#include "rhutil/testing/assertions.h"
+#include "gtest/gtest.h"
+#include "absl/strings/match.h"
+#include "absl/strings/str_cat.h"
+#include "absl/synchronization/mutex.h"
+
+namespace rhutil {
+namespace {
+
+// Returns the value of the request header name (given as "Name: "), or an
+// empty string.
+std::string RequestHeader(const std::string &request, const char *name) {
+  auto start = request.find(name);
+  if (start == std::string::npos) return "";
+  start += std::string_view(name).size();
+  return request.substr(start, request.find('\r', start) - start);
+}
+
+// Serves one request per connection:
+//
+//  - /vary/...: fresh for a minute, varying on Accept-Language, whose value
+//    is the body.
+//  - /etag/...: revalidated on every use. If-None-Match "v1" gets a 304.
+//  - anything else: no-store.
+//
+// and records every request line and its If-None-Match.
+class CacheServer {
+ public:
+  LoopbackServer::ServeFunction Serve() {
+    return [this](int fd) {
+      std::string request;
+      char buffer[4096];
+      while (request.find("\r\n\r\n") == std::string::npos) {
+        ssize_t n = read(fd, buffer, sizeof(buffer));
+        if (n <= 0) return;
+        request.append(buffer, n);
+      }
+      const std::string path = request.substr(4, request.find(' ', 4) - 4);
+      const std::string if_none_match =
+          RequestHeader(request, "If-None-Match: ");
+      {
+        absl::MutexLock lock(&mu_);
+        paths_.push_back(path);
+        if_none_match_.push_back(if_none_match);
+      }
+      std::string headers, body;
+      if (absl::StartsWith(path, "/vary/")) {
+        headers = "Cache-Control: max-age=60\r\nVary: Accept-Language\r\n";
+        body = RequestHeader(request, "Accept-Language: ");
+      } else if (absl::StartsWith(path, "/etag/")) {
+        if (if_none_match == "\"v1\"") {
+          Respond(fd, "304 Not Modified", "ETag: \"v1\"\r\n", "");
+          return;
+        }
+        headers = "Cache-Control: no-cache\r\nETag: \"v1\"\r\n";
+        body = "etag body";
+      } else {
+        headers = "Cache-Control: no-store\r\n";
+        body = "not stored";
+      }
+      Respond(fd, "200 OK", headers, body);
+    };
+  }
+
+  std::vector<std::string> paths() {
+    absl::MutexLock lock(&mu_);
+    return paths_;
+  }
+
+  std::vector<std::string> if_none_match() {
+    absl::MutexLock lock(&mu_);
+    return if_none_match_;
+  }
+
+ private:
+  static void Respond(int fd, std::string_view status,
+                      std::string_view headers, std::string_view body) {
+    const std::string response = absl::StrCat(
+        "HTTP/1.1 ", status, "\r\n", headers,
+        "Content-Length: ", body.size(), "\r\nConnection: close\r\n\r\n",
+        body);
+    send(fd, response.data(), response.size(), MSG_NOSIGNAL);
+    shutdown(fd, SHUT_WR);
+  }
+
+  absl::Mutex mu_;
+  std::vector<std::string> paths_ GUARDED_BY(mu_);
+  std::vector<std::string> if_none_match_ GUARDED_BY(mu_);
+};
+
+class HttpCacheTest : public ::testing::Test {
+ protected:
+  void SetUp() override { ASSERT_TRUE(IsOk(CurlGlobalInit())); }
+
+  StatusOr<HttpCache::Response> Fetch(
+      HttpCache *cache, std::string_view path,
+      absl::Span<const std::string_view> request_headers = {}) {
+    ASSIGN_OR_RETURN(CurlURL url, CurlURL::FromString(server_.URL(path)));
+    auto handle = CurlEasyInit();
+    return cache->Fetch(handle.get(), url, request_headers);
+  }
+
+  CacheServer cache_server_;
+  LoopbackServer server_{cache_server_.Serve()};
+};
+
+TEST_F(HttpCacheTest, VaryMatchesRequestHeaders) {
+  HttpCache cache;
+  const std::string_view en[] = {"Accept-Language: en"};
+  const std::string_view fr[] = {"Accept-Language: fr"};
+  for (int i = 0; i < 2; ++i) {
+    SCOPED_TRACE(i);
+    auto response = Fetch(&cache, "/vary/a", en);
+    ASSERT_TRUE(IsOk(response));
+    EXPECT_EQ(*response.ValueOrDie().body, "en");
+    EXPECT_EQ(response.ValueOrDie().from_cache, i > 0);
+
+    response = Fetch(&cache, "/vary/a", fr);
+    ASSERT_TRUE(IsOk(response));
+    EXPECT_EQ(*response.ValueOrDie().body, "fr");
+    EXPECT_EQ(response.ValueOrDie().from_cache, i > 0);
+  }
+  EXPECT_EQ(cache_server_.paths().size(), 2);
+  EXPECT_EQ(cache.GetStats().hits, 2);
+  EXPECT_EQ(cache.GetStats().entries, 2);
+}
+
+TEST_F(HttpCacheTest, RevalidatesWithETag) {
+  HttpCache cache;
+  auto response = Fetch(&cache, "/etag/a");
+  ASSERT_TRUE(IsOk(response));
+  EXPECT_FALSE(response.ValueOrDie().from_cache);
+
+  response = Fetch(&cache, "/etag/a");
+  ASSERT_TRUE(IsOk(response));
+  EXPECT_EQ(response.ValueOrDie().response_code, 200);
+  EXPECT_EQ(*response.ValueOrDie().body, "etag body");
+  EXPECT_TRUE(response.ValueOrDie().from_cache);
+  EXPECT_TRUE(response.ValueOrDie().revalidated);
+  EXPECT_EQ(cache_server_.if_none_match(),
+            (std::vector<std::string>{"", "\"v1\""}));
+  EXPECT_EQ(cache.GetStats().revalidations, 1);
+}
+
+TEST_F(HttpCacheTest, ReadsBackFromDisk) {
+  // Under bazel test, TEST_TMPDIR is removed afterwards.
+  const char *tmpdir = getenv("TEST_TMPDIR");
+  std::string directory =
+      absl::StrCat(tmpdir != nullptr ? tmpdir : "/tmp", "/http_cache.XXXXXX");
+  ASSERT_NE(mkdtemp(directory.data()), nullptr);
+  HttpCache::Options options;
+  options.disk_directory = directory;
+  const std::string_view en[] = {"Accept-Language: en"};
+  {
+    HttpCache cache(options);
+    ASSERT_TRUE(IsOk(Fetch(&cache, "/vary/a", en)));
+  }
+
+  // A new cache, as in a later process, finds both the response and what it
+  // varies on.
+  HttpCache cache(options);
+  auto response = Fetch(&cache, "/vary/a", en);
+  ASSERT_TRUE(IsOk(response));
+  EXPECT_EQ(*response.ValueOrDie().body, "en");
+  EXPECT_TRUE(response.ValueOrDie().from_cache);
+  EXPECT_EQ(cache.GetStats().disk_reads, 1);
+  EXPECT_EQ(cache_server_.paths().size(), 1);
+
+  const std::string_view fr[] = {"Accept-Language: fr"};
+  response = Fetch(&cache, "/vary/a", fr);
+  ASSERT_TRUE(IsOk(response));
+  EXPECT_FALSE(response.ValueOrDie().from_cache);
+}
+
+TEST_F(HttpCacheTest, KeepsNothingForUncachedURLs) {
+  HttpCache cache;
+  for (int i = 0; i < 20; ++i) {
+    ASSERT_TRUE(IsOk(Fetch(&cache, absl::StrCat("/no-store/", i))));
+  }
+  EXPECT_EQ(cache.GetStats().misses, 20);
+  EXPECT_EQ(cache.GetStats().entries, 0);
+  EXPECT_EQ(cache.GetStats().memory_bytes, 0);
+}
+
+TEST_F(HttpCacheTest, EvictionBoundsMemory) {
+  HttpCache::Options options;
+  options.max_memory_bytes = 4096;
+  HttpCache cache(options);
+  const std::string_view en[] = {"Accept-Language: en"};
+  for (int i = 0; i < 100; ++i) {
+    ASSERT_TRUE(IsOk(Fetch(&cache, absl::StrCat("/vary/", i), en)));
+    EXPECT_LE(cache.GetStats().memory_bytes, options.max_memory_bytes);
+  }
+  HttpCache::Stats stats = cache.GetStats();
+  EXPECT_GT(stats.evictions, 0);
+  EXPECT_LT(stats.entries, 100);
+}
+
+}  // namespace
+}  // namespace rhutil
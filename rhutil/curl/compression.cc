@@ -0,0 +1,105 @@
+#include "rhutil/curl/compression.h"
+
+#include <cstring>
+
+#include "rhutil/curl/curl.h"
+
+namespace rhutil {
+namespace {
+
+// Adding 16 to the window bits makes zlib write a gzip header and trailer.
+constexpr int kGzipWindowBits = 15 + 16;
+constexpr std::size_t kOutputChunk = 16 << 10;
+
+Status ZlibCodeToStatus(int code, const z_stream &stream) {
+  const char *msg = stream.msg != nullptr ? stream.msg : zError(code);
+  switch (code) {
+    case Z_OK:
+    case Z_STREAM_END:
+      return OkStatus();
+    case Z_MEM_ERROR:
+      return ResourceExhaustedError(msg);
+    case Z_STREAM_ERROR:
+      return InvalidArgumentError(msg);
+    case Z_DATA_ERROR:
+      return DataLossError(msg);
+    default:
+      return StatusBuilder(UnknownError(msg)) << " (zlib code " << code << ")";
+  }
+}
+
+}  // namespace
+
+bool CurlSupportsCompression() {
+  curl_version_info_data *info = curl_version_info(CURLVERSION_NOW);
+  return (info->features & (CURL_VERSION_LIBZ | CURL_VERSION_BROTLI)) != 0;
+}
+
+Status CurlEasyEnableCompression(CURL *handle) {
+  // An empty string asks libcurl for all of its built-in encodings.
+  return CurlEasySetopt(handle, CURLOPT_ACCEPT_ENCODING, "");
+}
+
+GzipCompressor::GzipCompressor(int level) {
+  std::memset(&stream_, 0, sizeof(stream_));
+  CHECK(deflateInit2(&stream_, level, Z_DEFLATED, kGzipWindowBits,
+                     /*memLevel=*/8, Z_DEFAULT_STRATEGY) == Z_OK);
+}
+
+GzipCompressor::~GzipCompressor() { deflateEnd(&stream_); }
+
+Status GzipCompressor::Compress(std::string_view data, std::string *out) {
+  return Deflate(data, Z_NO_FLUSH, out);
+}
+
+Status GzipCompressor::Finish(std::string *out) {
+  RETURN_IF_ERROR(Deflate({}, Z_FINISH, out));
+  finished_ = true;
+  return OkStatus();
+}
+
+Status GzipCompressor::Deflate(std::string_view data, int flush,
+                               std::string *out) {
+  if (finished_) {
+    return FailedPreconditionError("GzipCompressor already finished");
+  }
+  stream_.next_in =
+      reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+  stream_.avail_in = data.size();
+  int code;
+  do {
+    const std::size_t offset = out->size();
+    out->resize(offset + kOutputChunk);
+    stream_.next_out = reinterpret_cast<Bytef*>(&(*out)[offset]);
+    stream_.avail_out = kOutputChunk;
+    code = deflate(&stream_, flush);
+    out->resize(out->size() - stream_.avail_out);
+    // Z_BUF_ERROR only means no progress was possible, which is expected
+    // once all input has been consumed.
+    if (code != Z_OK && code != Z_STREAM_END && code != Z_BUF_ERROR) {
+      return ZlibCodeToStatus(code, stream_);
+    }
+  } while (stream_.avail_out == 0 ||
+           (flush == Z_FINISH && code != Z_STREAM_END));
+  return OkStatus();
+}
+
+StatusOr<std::string> GzipCompress(std::string_view data, int level) {
+  GzipCompressor compressor(level);
+  std::string out;
+  out.reserve(compressBound(data.size()) + 18);
+  RETURN_IF_ERROR(compressor.Compress(data, &out));
+  RETURN_IF_ERROR(compressor.Finish(&out));
+  return out;
+}
+
+Status CurlEasySetGzipPostBody(CURL *handle, std::string_view body,
+                               int level) {
+  ASSIGN_OR_RETURN(std::string compressed, GzipCompress(body, level));
+  // The size must be set first, or libcurl copies up to the first NUL.
+  RETURN_IF_ERROR(CurlEasySetopt(handle, CURLOPT_POSTFIELDSIZE_LARGE,
+                                 static_cast<curl_off_t>(compressed.size())));
+  return CurlEasySetopt(handle, CURLOPT_COPYPOSTFIELDS, compressed.data());
+}
+
+}  // namespace rhutil
@@ -0,0 +1,62 @@
+#ifndef RHUTIL_CURL_COMPRESSION_H_
+#define RHUTIL_CURL_COMPRESSION_H_
+
+#include <string>
+#include <string_view>
+
+#include "rhutil/status.h"
+#include "curl/curl.h"
+#include "zlib.h"
+
+namespace rhutil {
+
+// The header to send along with a body compressed by GzipCompressor.
+inline constexpr char kGzipContentEncodingHeader[] = "Content-Encoding: gzip";
+
+// Returns whether the linked libcurl can decode compressed responses.
+bool CurlSupportsCompression();
+
+// Advertises every content encoding the linked libcurl can decode (gzip and
+// deflate, and brotli if it was built with it) in Accept-Encoding. Compressed
+// responses are decoded incrementally as they arrive, before they reach the
+// write callback or sink, so the body is never buffered in compressed form.
+// CURLINFO_SIZE_DOWNLOAD_T (and TransferStats::bytes_downloaded) still count
+// the compressed bytes.
+Status CurlEasyEnableCompression(CURL *handle);
+
+// Incrementally gzip-compresses a stream, e.g. a request body produced in
+// chunks. Not thread-safe.
+class GzipCompressor {
+ public:
+  // level is a zlib compression level in [-1, 9].
+  explicit GzipCompressor(int level = Z_DEFAULT_COMPRESSION);
+  ~GzipCompressor();
+
+  GzipCompressor(const GzipCompressor &) = delete;
+  GzipCompressor &operator=(const GzipCompressor &) = delete;
+
+  // Appends to *out as much compressed output as is ready.
+  Status Compress(std::string_view data, std::string *out);
+  // Appends the remaining output and the gzip trailer to *out. The compressor
+  // can not be used afterwards.
+  Status Finish(std::string *out);
+
+ private:
+  Status Deflate(std::string_view data, int flush, std::string *out);
+
+  z_stream stream_;
+  bool finished_ = false;
+};
+
+StatusOr<std::string> GzipCompress(std::string_view data,
+                                   int level = Z_DEFAULT_COMPRESSION);
+
+// Makes the transfer a POST of body, compressed with gzip. libcurl keeps its
+// own copy of the compressed body. The caller must add
+// kGzipContentEncodingHeader to CURLOPT_HTTPHEADER.
+Status CurlEasySetGzipPostBody(CURL *handle, std::string_view body,
+                               int level = Z_DEFAULT_COMPRESSION);
+
+}  // namespace rhutil
+
+#endif  // RHUTIL_CURL_COMPRESSION_H_
@@ -0,0 +1,123 @@
+#include "rhutil/curl/coro.h"
+
+#include <algorithm>
+
+#include "rhutil/curl/sinks.h"
+#include "absl/time/clock.h"
+
+namespace rhutil {
+namespace {
+
+// How long a worker waits before polling again after Poll fails, doubling
+// with each failure in a row.
+constexpr absl::Duration kMinPollRetryDelay = absl::Milliseconds(1);
+constexpr absl::Duration kMaxPollRetryDelay = absl::Seconds(1);
+
+}  // namespace
+
+CurlEventLoop::Worker::Worker() : thread_([this] { Run(); }) {}
+
+CurlEventLoop::Worker::~Worker() {
+  {
+    absl::MutexLock lock(&mu_);
+    stopping_ = true;
+  }
+  CHECK_OK(multi_.Wakeup());
+  thread_.join();
+}
+
+void CurlEventLoop::Worker::Start(
+    std::unique_ptr<CURL, CurlHandleDeleter> handle,
+    CurlMulti::DoneCallback done) {
+  {
+    absl::MutexLock lock(&mu_);
+    pending_.push_back({std::move(handle), std::move(done)});
+  }
+  CHECK_OK(multi_.Wakeup());
+}
+
+void CurlEventLoop::Worker::Run() {
+  absl::Duration retry_delay = kMinPollRetryDelay;
+  while (true) {
+    std::vector<Pending> pending;
+    bool stopping;
+    {
+      absl::MutexLock lock(&mu_);
+      pending.swap(pending_);
+      stopping = stopping_;
+    }
+    for (Pending &transfer : pending) {
+      // CurlMulti::Add only takes the handle if it succeeds.
+      CURL *handle = transfer.handle.get();
+      Status st = multi_.Add(std::move(transfer.handle), transfer.done);
+      if (!st.ok()) {
+        transfer.done(std::unique_ptr<CURL, CurlHandleDeleter>(handle),
+                      std::move(st));
+      }
+    }
+    // Done callbacks may start more transfers, so only stop once the last
+    // one has finished and no more were queued while it ran.
+    if (stopping && pending.empty() && multi_.empty()) return;
+    Status st = multi_.Poll(absl::InfiniteDuration());
+    if (st.ok()) {
+      retry_delay = kMinPollRetryDelay;
+      continue;
+    }
+    // The transfers the worker was driving are lost, and their coroutines
+    // resume with the error. Whatever broke the loop may be transient (e.g.
+    // running out of memory), so the worker carries on, but backs off so that
+    // an error which persists does not spin.
+    multi_.FailAll(st);
+    absl::SleepFor(retry_delay);
+    retry_delay = std::min(retry_delay * 2, kMaxPollRetryDelay);
+  }
+}
+
+CurlEventLoop::CurlEventLoop(int threads) {
+  for (int i = 0; i < std::max(threads, 1); ++i) {
+    workers_.push_back(std::make_unique<Worker>());
+  }
+}
+
+CurlEventLoop::~CurlEventLoop() = default;
+
+void CurlEventLoop::Start(std::unique_ptr<CURL, CurlHandleDeleter> handle,
+                          CurlMulti::DoneCallback done) {
+  const std::size_t worker = next_worker_++ % workers_.size();
+  workers_[worker]->Start(std::move(handle), std::move(done));
+}
+
+FetchAwaiter::FetchAwaiter(CurlEventLoop *loop, CURL *handle)
+  : loop_(loop), handle_(handle) {}
+
+bool FetchAwaiter::await_ready() const noexcept { return false; }
+
+void FetchAwaiter::await_suspend(std::coroutine_handle<> waiter) {
+  // The loop borrows the caller's handle, and gives it back before resuming.
+  loop_->Start(std::unique_ptr<CURL, CurlHandleDeleter>(handle_),
+               [this, waiter](std::unique_ptr<CURL, CurlHandleDeleter> handle,
+                              Status status) {
+                 handle.release();
+                 status_ = std::move(status);
+                 waiter.resume();
+               });
+}
+
+Status FetchAwaiter::await_resume() { return std::move(status_); }
+
+FetchAwaiter Fetch(CurlEventLoop *loop, CURL *handle) {
+  return FetchAwaiter(loop, handle);
+}
+
+Task<StatusOr<std::string>> FetchBody(CurlEventLoop *loop, CURL *handle) {
+  std::string body;
+  StringSink sink(&body);
+  CO_RETURN_IF_ERROR(CurlEasySetWriteSink(handle, &sink));
+  Status status = co_await Fetch(loop, handle);
+  // The sink is about to go away.
+  CO_RETURN_IF_ERROR(CurlEasySetWriteCallback(handle, nullptr));
+  CO_RETURN_IF_ERROR(status);
+  co_return body;
+}
+
+}  // namespace rhutil
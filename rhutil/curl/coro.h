@@ -0,0 +1,254 @@
+#ifndef RHUTIL_CURL_CORO_H_
+#define RHUTIL_CURL_CORO_H_
+
+// Coroutine support for curl transfers. Unlike the rest of rhutil this needs
+// C++20, so only code built with -std=c++20 may include it.
+#if !defined(__cpp_impl_coroutine)
+#error "rhutil/curl/coro.h requires C++20 coroutines (-std=c++20)"
+#endif
+
+#include <atomic>
+#include <coroutine>
+#include <cstddef>
+#include <exception>
+#include <memory>
+#include <optional>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "rhutil/status.h"
+#include "rhutil/curl/curl.h"
+#include "rhutil/curl/multi.h"
+#include "absl/base/thread_annotations.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/synchronization/notification.h"
+
+// Coroutine counterparts of RETURN_IF_ERROR and ASSIGN_OR_RETURN, for use in
+// a Task.
+#define CO_RETURN_IF_ERROR(expr) \
+  if (::rhutil::Status s = (expr); !s.ok()) \
+    co_return ::rhutil::StatusBuilder(s)
+
+#define CO_ASSIGN_OR_RETURN(decl, expr) \
+  CO_ASSIGN_OR_RETURN_IMPL( \
+      RHUTIL_CORO_CONCAT(co_statusor_, __LINE__), decl, expr)
+
+namespace rhutil {
+
+// Runs transfers on a few threads, each with its own CurlMulti. Transfers are
+// spread across the threads round-robin.
+class CurlEventLoop {
+ public:
+  explicit CurlEventLoop(int threads = 1);
+  // Waits for the transfers in flight to finish. Their done callbacks must
+  // not start more.
+  ~CurlEventLoop();
+
+  CurlEventLoop(const CurlEventLoop &) = delete;
+  CurlEventLoop &operator=(const CurlEventLoop &) = delete;
+
+  // Starts handle's transfer. done is invoked on one of the loop's threads,
+  // and must not block. Thread-safe.
+  void Start(std::unique_ptr<CURL, CurlHandleDeleter> handle,
+             CurlMulti::DoneCallback done);
+
+ private:
+  class Worker {
+   public:
+    Worker();
+    ~Worker();
+
+    void Start(std::unique_ptr<CURL, CurlHandleDeleter> handle,
+               CurlMulti::DoneCallback done);
+
+   private:
+    struct Pending {
+      std::unique_ptr<CURL, CurlHandleDeleter> handle;
+      CurlMulti::DoneCallback done;
+    };
+
+    void Run();
+
+    CurlMulti multi_;
+    absl::Mutex mu_;
+    std::vector<Pending> pending_ GUARDED_BY(mu_);
+    bool stopping_ GUARDED_BY(mu_) = false;
+    std::thread thread_;
+  };
+
+  std::vector<std::unique_ptr<Worker>> workers_;
+  std::atomic<std::size_t> next_worker_{0};
+};
+
+// A lazily started coroutine producing a T, usually a Status or StatusOr.
+// Tasks start when awaited by another Task, or by SyncWait.
+template <typename T>
+class [[nodiscard]] Task {
+ public:
+  class promise_type;
+
+  Task(Task &&o);
+  Task &operator=(Task &&o);
+  ~Task();
+
+  bool await_ready() const noexcept;
+  bool await_suspend(std::coroutine_handle<> waiter);
+  T await_resume();
+
+ private:
+  template <typename U>
+  friend U SyncWait(Task<U> task);
+
+  explicit Task(std::coroutine_handle<promise_type> handle);
+
+  std::coroutine_handle<promise_type> handle_;
+};
+
+// Runs task to completion, blocking the calling thread. Must not be called
+// from a CurlEventLoop thread.
+template <typename T>
+T SyncWait(Task<T> task);
+
+// Awaiting the result of Fetch performs handle's transfer on loop without
+// blocking a thread, and produces the Status CurlEasyPerform would have. The
+// coroutine resumes on one of loop's threads.
+class FetchAwaiter {
+ public:
+  FetchAwaiter(CurlEventLoop *loop, CURL *handle);
+
+  bool await_ready() const noexcept;
+  void await_suspend(std::coroutine_handle<> waiter);
+  Status await_resume();
+
+ private:
+  CurlEventLoop *loop_;
+  CURL *handle_;
+  Status status_;
+};
+
+// handle remains owned by the caller, and must not be used until the
+// transfer finishes.
+FetchAwaiter Fetch(CurlEventLoop *loop, CURL *handle);
+
+// Performs handle's transfer on loop, and produces the response body.
+Task<StatusOr<std::string>> FetchBody(CurlEventLoop *loop, CURL *handle);
+
+// implementation details below
+
+#define RHUTIL_CORO_CONCAT_IMPL(x, y) x##y
+#define RHUTIL_CORO_CONCAT(x, y) RHUTIL_CORO_CONCAT_IMPL(x, y)
+#define CO_ASSIGN_OR_RETURN_IMPL(statusor, decl, expr) \
+  auto statusor = (expr); \
+  if (!statusor.ok()) co_return std::move(statusor).status(); \
+  decl = std::move(statusor).ValueOrDie()
+
+template <typename T>
+class Task<T>::promise_type {
+ public:
+  Task get_return_object() {
+    return Task(std::coroutine_handle<promise_type>::from_promise(*this));
+  }
+
+  std::suspend_always initial_suspend() noexcept { return {}; }
+
+  auto final_suspend() noexcept {
+    struct FinalAwaiter {
+      bool await_ready() noexcept { return false; }
+      std::coroutine_handle<> await_suspend(
+          std::coroutine_handle<promise_type> handle) noexcept {
+        promise_type &promise = handle.promise();
+        if (promise.waiter_) {
+          // If the waiter has suspended, this resumes it. Otherwise the task
+          // finished before Task::await_suspend returned, which continues the
+          // waiter itself.
+          if (promise.finished_or_suspended_.exchange(
+                  true, std::memory_order_acq_rel)) {
+            return promise.waiter_;
+          }
+          return std::noop_coroutine();
+        }
+        // The frame may be destroyed as soon as SyncWait wakes up.
+        promise.done_->Notify();
+        return std::noop_coroutine();
+      }
+      void await_resume() noexcept {}
+    };
+    return FinalAwaiter{};
+  }
+
+  template <typename U>
+  void return_value(U &&value) {
+    value_.emplace(std::forward<U>(value));
+  }
+
+  void unhandled_exception() { std::terminate(); }
+
+ private:
+  friend class Task;
+  template <typename U>
+  friend U SyncWait(Task<U> task);
+
+  std::optional<T> value_;
+  // Resumed when the task finishes, if set. Otherwise done_ is notified.
+  std::coroutine_handle<> waiter_;
+  // Set by the first of the task finishing and Task::await_suspend
+  // returning. Whichever comes second continues the waiter.
+  std::atomic<bool> finished_or_suspended_{false};
+  absl::Notification *done_ = nullptr;
+};
+
+template <typename T>
+Task<T>::Task(std::coroutine_handle<promise_type> handle) : handle_(handle) {}
+
+template <typename T>
+Task<T>::Task(Task &&o) : handle_(std::exchange(o.handle_, nullptr)) {}
+
+template <typename T>
+Task<T> &Task<T>::operator=(Task &&o) {
+  if (this == &o) return *this;
+  if (handle_) handle_.destroy();
+  handle_ = std::exchange(o.handle_, nullptr);
+  return *this;
+}
+
+template <typename T>
+Task<T>::~Task() {
+  if (handle_) handle_.destroy();
+}
+
+template <typename T>
+bool Task<T>::await_ready() const noexcept { return false; }
+
+// Rather than transferring to the task, this runs it until it first
+// suspends, and if it has already finished returns false to continue the
+// waiter. Symmetric transfer alone is only a tail call when optimizing, so a
+// waiter awaiting many tasks which finish without suspending would otherwise
+// overflow the stack in debug builds.
+template <typename T>
+bool Task<T>::await_suspend(std::coroutine_handle<> waiter) {
+  promise_type &promise = handle_.promise();
+  promise.waiter_ = waiter;
+  handle_.resume();
+  return !promise.finished_or_suspended_.exchange(true,
+                                                  std::memory_order_acq_rel);
+}
+
+template <typename T>
+T Task<T>::await_resume() {
+  return std::move(*handle_.promise().value_);
+}
+
+template <typename T>
+T SyncWait(Task<T> task) {
+  absl::Notification done;
+  task.handle_.promise().done_ = &done;
+  task.handle_.resume();
+  done.WaitForNotification();
+  return std::move(*task.handle_.promise().value_);
+}
+
+}  // namespace rhutil
+
+#endif  // RHUTIL_CURL_CORO_H_
@@ -0,0 +1,137 @@
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "rhutil/curl/coro.h"
+#include "rhutil/curl/curl.h"
+#include "rhutil/curl/testing/loopback_server.h"
+#include "rhutil/testing/assertions.h"
+#include "gtest/gtest.h"
+
+namespace rhutil {
+namespace {
+
+Task<int> Double(int x) { co_return 2 * x; }
+
+Task<int> SumOfDoubles(int n) {
+  int sum = 0;
+  for (int i = 0; i < n; ++i) sum += co_await Double(1);
+  co_return sum;
+}
+
+Task<int> Nested(int depth) {
+  if (depth == 0) co_return 0;
+  co_return 1 + co_await Nested(depth - 1);
+}
+
+TEST(TaskTest, AwaitsNestedTasks) {
+  EXPECT_EQ(SyncWait(Double(21)), 42);
+  EXPECT_EQ(SyncWait(Nested(100)), 100);
+  // Enough awaits in a row to overflow the stack unless each resumes its
+  // waiter by symmetric transfer.
+  EXPECT_EQ(SyncWait(SumOfDoubles(1000000)), 2000000);
+}
+
+Task<Status> FailIf(bool fail) {
+  if (fail) co_return NotFoundError("failed");
+  co_return OkStatus();
+}
+
+Task<StatusOr<int>> ValueOr(bool fail) {
+  if (fail) co_return NotFoundError("no value");
+  co_return 7;
+}
+
+// Records how far it got.
+Task<StatusOr<int>> UseMacros(bool fail_status, bool fail_value,
+                              int *reached) {
+  CO_RETURN_IF_ERROR(co_await FailIf(fail_status)) << "while checking";
+  *reached = 1;
+  CO_ASSIGN_OR_RETURN(int value, co_await ValueOr(fail_value));
+  *reached = 2;
+  co_return value + 1;
+}
+
+TEST(TaskTest, MacrosPropagateErrors) {
+  int reached = 0;
+  StatusOr<int> result = SyncWait(UseMacros(false, false, &reached));
+  ASSERT_TRUE(IsOk(result));
+  EXPECT_EQ(result.ValueOrDie(), 8);
+  EXPECT_EQ(reached, 2);
+
+  reached = 0;
+  result = SyncWait(UseMacros(true, false, &reached));
+  EXPECT_EQ(result.status().code(), StatusCode::kNotFound);
+  EXPECT_NE(result.status().message().find("while checking"),
+            std::string::npos);
+  EXPECT_EQ(reached, 0);
+
+  reached = 0;
+  result = SyncWait(UseMacros(false, true, &reached));
+  EXPECT_EQ(result.status().code(), StatusCode::kNotFound);
+  EXPECT_EQ(reached, 1);
+}
+
+// Fetches each path in turn on one handle, so every fetch after the first
+// starts from a loop thread, where the previous one resumed the coroutine.
+Task<StatusOr<std::vector<std::string>>> FetchAll(
+    CurlEventLoop *loop, const LoopbackServer *server,
+    std::vector<std::string> paths) {
+  auto handle = CurlEasyInit();
+  std::vector<std::string> bodies;
+  for (const std::string &path : paths) {
+    CO_RETURN_IF_ERROR(
+        CurlEasySetopt(handle.get(), CURLOPT_URL, server->URL(path).c_str()));
+    CO_ASSIGN_OR_RETURN(std::string body,
+                        co_await FetchBody(loop, handle.get()));
+    bodies.push_back(std::move(body));
+  }
+  co_return bodies;
+}
+
+class FetchTest : public ::testing::Test {
+ protected:
+  void SetUp() override { ASSERT_TRUE(IsOk(CurlGlobalInit())); }
+};
+
+TEST_F(FetchTest, FetchBody) {
+  LoopbackServer server(&ServeHTTP1);
+  CurlEventLoop loop(2);
+  auto bodies = SyncWait(FetchAll(&loop, &server, {"/", "/bytes/4096", "/"}));
+  ASSERT_TRUE(IsOk(bodies));
+  ASSERT_EQ(bodies.ValueOrDie().size(), 3);
+  EXPECT_EQ(bodies.ValueOrDie()[0], kLoopbackBody);
+  EXPECT_EQ(bodies.ValueOrDie()[1].size(), 4096);
+  EXPECT_EQ(bodies.ValueOrDie()[2], kLoopbackBody);
+}
+
+TEST_F(FetchTest, ConcurrentCallers) {
+  LoopbackServer server(&ServeHTTP1);
+  CurlEventLoop loop(2);
+  std::vector<std::thread> threads;
+  std::vector<StatusOr<std::vector<std::string>>> results(8);
+  for (auto &result : results) {
+    threads.emplace_back([&loop, &server, &result] {
+      result = SyncWait(FetchAll(&loop, &server, {"/", "/"}));
+    });
+  }
+  for (std::thread &thread : threads) thread.join();
+  for (const auto &result : results) {
+    ASSERT_TRUE(IsOk(result));
+    EXPECT_EQ(result.ValueOrDie(),
+              (std::vector<std::string>(2, std::string(kLoopbackBody))));
+  }
+}
+
+TEST_F(FetchTest, TransferErrorResumesWithStatus) {
+  CurlEventLoop loop;
+  auto handle = CurlEasyInit();
+  // Nothing listens on port 1.
+  ASSERT_TRUE(IsOk(
+      CurlEasySetopt(handle.get(), CURLOPT_URL, "http://127.0.0.1:1/")));
+  auto body = SyncWait(FetchBody(&loop, handle.get()));
+  EXPECT_FALSE(body.ok());
+}
+
+}  // namespace
+}  // namespace rhutil
@@ -1,14 +1,19 @@
 #include "rhutil/curl/curl.h"
 
+#include <algorithm>
 #include <cstddef>
 #include <cstdio>
 #include <string>
 #include <memory>
+#include <optional>
 #include <string_view>
 
 #include "rhutil/errno.h"
 #include "absl/strings/str_cat.h"
 #include "absl/strings/numbers.h"
+#include "absl/strings/ascii.h"
+#include "absl/strings/match.h"
+#include "absl/time/clock.h"
 
 namespace rhutil {
 namespace {
@@ -26,7 +31,18 @@ CURLU *CurlURLDupUnlessNull(CURLU *url) {
 
 struct CurlHandlePrivate {
   std::function<Status(std::string_view, size_t*)> write_callback;
+  internal_curl::WriteSinkContext write_sink;
   Status last_write_error;
+  std::function<Status(absl::Span<char>, size_t*)> read_callback;
+  internal_curl::ReadSourceContext read_source;
+  Status last_read_error;
+  // Allocated by the first CurlEasyCaptureHeaders, and kept for reuse.
+  std::unique_ptr<CurlResponseHeaders> headers;
+  bool capture_headers = false;
+  std::function<Status(const CurlResponseHeaders&)> on_headers_complete;
+  std::optional<CurlContext> context;
+  // Why CurlXferInfoCallback aborted the transfer.
+  Status context_error;
   char error_buffer[CURL_ERROR_SIZE] = { '\0' };
 };
 
@@ -52,48 +68,64 @@ size_t CurlWriteCallback(char *ptr, size_t, size_t nmemb, void *userdata) {
   return err.ok() ? nmemb : err_rc;
 }
 
-constexpr absl::Span<const curl_lock_data> GetAllCurlLockData() {
-  constexpr curl_lock_data all_curl_lock_data[] = {
-    CURL_LOCK_DATA_NONE,
-    CURL_LOCK_DATA_SHARE,
-    CURL_LOCK_DATA_COOKIE,
-    CURL_LOCK_DATA_DNS,
-    CURL_LOCK_DATA_SSL_SESSION,
-    CURL_LOCK_DATA_CONNECT,
-    CURL_LOCK_DATA_PSL
-  };
-  constexpr size_t num_curl_lock_data =
-      sizeof(all_curl_lock_data) / sizeof(curl_lock_data);
-  static_assert(
-      num_curl_lock_data == CURL_LOCK_DATA_LAST,
-      "all_curl_lock_data does not cover all possible lockable data in this "
-      "version of CURL");
-
-  return {all_curl_lock_data, num_curl_lock_data};
+size_t CurlReadCallback(char *buffer, size_t size, size_t nitems,
+                        void *userdata) {
+  auto *priv = reinterpret_cast<CurlHandlePrivate*>(userdata);
+  size_t read = 0;
+  Status err = priv->read_callback({buffer, size * nitems}, &read);
+  if (!err.ok()) {
+    priv->last_read_error = err;
+    return CURL_READFUNC_ABORT;
+  }
+  return read;
 }
 
-}  // namespace
+size_t CurlHeaderCallback(char *buffer, size_t, size_t nitems,
+                          void *userdata) {
+  auto *priv = reinterpret_cast<CurlHandlePrivate*>(userdata);
+  CurlResponseHeaders &headers = *priv->headers;
+  const bool was_complete = headers.complete();
+  headers.Append({buffer, nitems});
+  if (!was_complete && headers.complete() && headers.status_code() >= 200 &&
+      priv->on_headers_complete) {
+    Status err = priv->on_headers_complete(headers);
+    if (!err.ok()) {
+      priv->last_write_error = std::move(err);
+      return 0;
+    }
+  }
+  return nitems;
+}
 
-absl::flat_hash_map<curl_lock_data, std::unique_ptr<absl::Mutex>>
-ThreadSafeCurlShare::CreateMutexesMap() {
-  absl::flat_hash_map<curl_lock_data, std::unique_ptr<absl::Mutex>> mutexes;
-  for (curl_lock_data lock_data : GetAllCurlLockData()) {
-    mutexes.emplace(lock_data, std::make_unique<absl::Mutex>());
+Status CheckContext(const CurlContext &context) {
+  if (context.cancellation != nullptr && context.cancellation->cancelled()) {
+    return CancelledError("Transfer cancelled");
+  }
+  if (absl::Now() >= context.deadline) {
+    return DeadlineExceededError("Transfer deadline exceeded");
   }
-  return mutexes;
+  return OkStatus();
+}
+
+int CurlXferInfoCallback(void *clientp, curl_off_t, curl_off_t, curl_off_t,
+                         curl_off_t) {
+  auto *priv = reinterpret_cast<CurlHandlePrivate*>(clientp);
+  priv->context_error = CheckContext(*priv->context);
+  return priv->context_error.ok() ? 0 : 1;
 }
 
-absl::flat_hash_map<curl_lock_data,
-                    std::unique_ptr<ThreadSafeCurlShare::MutexLock>>
-ThreadSafeCurlShare::CreateLocksMap() {
-  absl::flat_hash_map<curl_lock_data,
-                      std::unique_ptr<ThreadSafeCurlShare::MutexLock>> locks;
-  for (curl_lock_data lock_data : GetAllCurlLockData()) {
-    locks.emplace(lock_data, nullptr);
+std::size_t WaitHistogramBucket(int64_t wait_ns) {
+  std::size_t bucket = 0;
+  while (wait_ns > 1 &&
+         bucket + 1 < ThreadSafeCurlShare::kWaitHistogramBuckets) {
+    wait_ns >>= 1;
+    ++bucket;
   }
-  return locks;
+  return bucket;
 }
 
+}  // namespace
+
 void CurlHandleDeleter::operator()(CURL *handle) {
   delete GetPrivate(handle);
   curl_easy_cleanup(handle);
@@ -111,6 +143,10 @@ void CurlShareDeleter::operator()(CURLSH *share) {
   CHECK_OK(CurlShareCodeToStatus(curl_share_cleanup(share)));
 }
 
+void CurlMultiDeleter::operator()(CURLM *multi) {
+  CHECK_OK(CurlMultiCodeToStatus(curl_multi_cleanup(multi)));
+}
+
 CurlURL::CurlURL(CURLU *url) : url_(url) {}
 
 CurlURL::CurlURL() : CurlURL(curl_url()) {}
@@ -244,8 +280,136 @@ std::unique_ptr<curl_slist, CurlSListDeleter> NewCurlSList(
   return ret;
 }
 
+bool CurlSupportsHTTP2() {
+  curl_version_info_data *info = curl_version_info(CURLVERSION_NOW);
+  return (info->features & CURL_VERSION_HTTP2) != 0;
+}
+
+Status CurlEasyEnableHTTP2(CURL *handle, bool prior_knowledge) {
+  long version = prior_knowledge ? CURL_HTTP_VERSION_2_PRIOR_KNOWLEDGE
+                                 : CURL_HTTP_VERSION_2TLS;
+  RETURN_IF_ERROR(CurlEasySetopt(handle, CURLOPT_HTTP_VERSION, version));
+  RETURN_IF_ERROR(CurlEasySetopt(handle, CURLOPT_PIPEWAIT, 1L));
+  return OkStatus();
+}
+
+std::string CurlUnixSocket::ToString() const {
+  if (path.empty()) return "";
+  return absl::StrCat(abstract ? "unix-abstract:" : "unix:", path);
+}
+
+Status CurlEasySetUnixSocket(CURL *handle, const CurlUnixSocket &socket) {
+  const char *path = socket.path.empty() ? nullptr : socket.path.c_str();
+  // Either option replaces the other.
+  return CurlEasySetopt(handle,
+                        socket.abstract ? CURLOPT_ABSTRACT_UNIX_SOCKET
+                                        : CURLOPT_UNIX_SOCKET_PATH,
+                        path);
+}
+
+Status CurlEasySetStreamWeight(CURL *handle, int weight) {
+  if (weight < 1 || weight > 256) {
+    return InvalidArgumentErrorBuilder()
+        << "HTTP/2 stream weight " << weight << " is not in [1, 256]";
+  }
+  return CurlEasySetopt(handle, CURLOPT_STREAM_WEIGHT,
+                        static_cast<long>(weight));
+}
+
+Status CurlEasySetStreamDependency(CURL *handle, CURL *parent,
+                                   bool exclusive) {
+  CURLoption option =
+      exclusive ? CURLOPT_STREAM_DEPENDS_E : CURLOPT_STREAM_DEPENDS;
+  return CurlEasySetopt(handle, option, parent);
+}
+
 Status CurlEasyPerform(CURL *handle) {
-  CURLcode code = curl_easy_perform(handle);
+  return CurlEasyResultToStatus(handle, curl_easy_perform(handle));
+}
+
+Status CurlEasyPerform(CURL *handle, TransferStats *stats) {
+  Status status = CurlEasyPerform(handle);
+  auto stats_or = CurlEasyGetTransferStats(handle);
+  if (!stats_or.ok()) {
+    status.Update(stats_or.status());
+    return status;
+  }
+  *stats = std::move(stats_or).ValueOrDie();
+  return status;
+}
+
+StatusOr<TransferStats> CurlEasyGetTransferStats(CURL *handle) {
+  TransferStats stats;
+  RETURN_IF_ERROR(CurlEasyGetInfo(handle, CURLINFO_RESPONSE_CODE,
+                                  &stats.response_code));
+  RETURN_IF_ERROR(CurlEasyGetInfo(handle, CURLINFO_HTTP_VERSION,
+                                  &stats.http_version));
+  RETURN_IF_ERROR(CurlEasyGetInfo(handle, CURLINFO_REDIRECT_COUNT,
+                                  &stats.redirect_count));
+  long num_connects = 0;
+  RETURN_IF_ERROR(CurlEasyGetInfo(handle, CURLINFO_NUM_CONNECTS,
+                                  &num_connects));
+  stats.connection_reused = num_connects == 0;
+
+  struct {
+    CURLINFO info;
+    absl::Duration *out;
+  } times[] = {
+    {CURLINFO_NAMELOOKUP_TIME_T, &stats.name_lookup},
+    {CURLINFO_CONNECT_TIME_T, &stats.connect},
+    {CURLINFO_APPCONNECT_TIME_T, &stats.app_connect},
+    {CURLINFO_PRETRANSFER_TIME_T, &stats.pre_transfer},
+    {CURLINFO_STARTTRANSFER_TIME_T, &stats.start_transfer},
+    {CURLINFO_TOTAL_TIME_T, &stats.total},
+    {CURLINFO_REDIRECT_TIME_T, &stats.redirect},
+  };
+  for (const auto &time : times) {
+    curl_off_t micros = 0;
+    RETURN_IF_ERROR(CurlEasyGetInfo(handle, time.info, &micros));
+    *time.out = absl::Microseconds(micros);
+  }
+
+  curl_off_t bytes = 0;
+  RETURN_IF_ERROR(CurlEasyGetInfo(handle, CURLINFO_SIZE_DOWNLOAD_T, &bytes));
+  stats.bytes_downloaded = bytes;
+  RETURN_IF_ERROR(CurlEasyGetInfo(handle, CURLINFO_SIZE_UPLOAD_T, &bytes));
+  stats.bytes_uploaded = bytes;
+  long size = 0;
+  RETURN_IF_ERROR(CurlEasyGetInfo(handle, CURLINFO_HEADER_SIZE, &size));
+  stats.header_bytes = size;
+  RETURN_IF_ERROR(CurlEasyGetInfo(handle, CURLINFO_REQUEST_SIZE, &size));
+  stats.request_bytes = size;
+  return stats;
+}
+
+absl::Duration TransferStats::DNSTime() const { return name_lookup; }
+
+absl::Duration TransferStats::ConnectTime() const {
+  if (connect == absl::ZeroDuration()) return absl::ZeroDuration();
+  return connect - name_lookup;
+}
+
+absl::Duration TransferStats::TLSTime() const {
+  if (app_connect == absl::ZeroDuration()) return absl::ZeroDuration();
+  return app_connect - connect;
+}
+
+absl::Duration TransferStats::FirstByteTime() const {
+  if (start_transfer == absl::ZeroDuration()) return absl::ZeroDuration();
+  return start_transfer - pre_transfer;
+}
+
+absl::Duration TransferStats::BodyTime() const {
+  if (start_transfer == absl::ZeroDuration()) return absl::ZeroDuration();
+  return total - start_transfer;
+}
+
+Status CurlEasyResultToStatus(CURL *handle, CURLcode code) {
+  if (code == CURLE_ABORTED_BY_CALLBACK) {
+    const CurlHandlePrivate *priv = GetPrivate(handle);
+    if (!priv->context_error.ok()) return priv->context_error;
+    if (!priv->last_read_error.ok()) return priv->last_read_error;
+  }
   if (code != CURLE_OK && code != CURLE_WRITE_ERROR) {
     return CurlCodeToStatus(code, handle);
   }
@@ -253,7 +417,9 @@ Status CurlEasyPerform(CURL *handle) {
   long response_code = -1;
   RETURN_IF_ERROR(CurlEasyGetInfo(handle, CURLINFO_RESPONSE_CODE,
                                   &response_code));
-  Status http_status = HTTPCodeToStatus(response_code);
+  // No response was received, e.g. for CURLOPT_CONNECT_ONLY transfers.
+  Status http_status = response_code == 0
+      ? OkStatus() : HTTPCodeToStatus(response_code);
 
   Status write_status;
   if (code == CURLE_WRITE_ERROR) {
@@ -267,11 +433,18 @@ Status CurlEasyPerform(CURL *handle) {
   return StatusBuilder(std::move(http_status)) << write_status;
 }
 
-ThreadSafeCurlShare::ThreadSafeCurlShare()
-  : share_(curl_share_init()), mutexes_(CreateMutexesMap()),
-    locks_(CreateLocksMap()) {
+ThreadSafeCurlShare::ThreadSafeCurlShare(bool collect_lock_stats)
+  : collect_lock_stats_(collect_lock_stats), share_(curl_share_init()) {
   CHECK(share_);
   CHECK_OK(CurlShareSetopt(share_.get(), CURLSHOPT_USERDATA, this));
+  CHECK_OK(CurlShareSetopt(
+      share_.get(), CURLSHOPT_LOCKFUNC,
+      static_cast<void(*)(CURL*, curl_lock_data, curl_lock_access, void*)>(
+          &ThreadSafeCurlShare::Lock)));
+  CHECK_OK(CurlShareSetopt(
+      share_.get(), CURLSHOPT_UNLOCKFUNC,
+      static_cast<void(*)(CURL*, curl_lock_data, void*)>(
+          &ThreadSafeCurlShare::Unlock)));
 }
 
 CURLSH *ThreadSafeCurlShare::ptr() const { return share_.get(); }
@@ -281,42 +454,38 @@ void ThreadSafeCurlShare::Lock(CURL *handle, curl_lock_data data,
   reinterpret_cast<ThreadSafeCurlShare*>(userptr)->Lock(handle, data, access);
 }
 
-ThreadSafeCurlShare::MutexLock::~MutexLock() = default;
-
-class ThreadSafeCurlShare::SharedMutexLock
-  : public ThreadSafeCurlShare::MutexLock {
- public:
-  SharedMutexLock(absl::Mutex *mu) : lock_(mu) {}
-  ~SharedMutexLock() override = default;
-
- private:
-  absl::ReaderMutexLock lock_;
-};
-
-class ThreadSafeCurlShare::SingleMutexLock
-  : public ThreadSafeCurlShare::MutexLock {
- public:
-  SingleMutexLock(absl::Mutex *mu) : lock_(mu) {}
-  ~SingleMutexLock() override = default;
-
- private:
-  absl::MutexLock lock_;
-};
-
 void ThreadSafeCurlShare::Lock(CURL*, curl_lock_data data,
                                curl_lock_access access) {
-  const std::unique_ptr<absl::Mutex> &mu = mutexes_.at(data);
-  std::unique_ptr<MutexLock> &lock = locks_.at(data);
-  switch (access) {
-    case CURL_LOCK_ACCESS_SHARED:
-      lock.reset(new SharedMutexLock(mu.get()));
-      break;
-    case CURL_LOCK_ACCESS_SINGLE:
-      lock.reset(new SingleMutexLock(mu.get()));
-      break;
-    default:
-      CHECK(false);
+  CHECK(data >= 0 && data < CURL_LOCK_DATA_LAST);
+  CHECK(access == CURL_LOCK_ACCESS_SHARED ||
+        access == CURL_LOCK_ACCESS_SINGLE);
+  LockSlot &slot = locks_[data];
+  const bool shared = access == CURL_LOCK_ACCESS_SHARED;
+
+  if (!collect_lock_stats_) {
+    if (shared) {
+      slot.mu.ReaderLock();
+    } else {
+      slot.mu.Lock();
+    }
+  } else {
+    bool acquired = shared ? slot.mu.ReaderTryLock() : slot.mu.TryLock();
+    if (!acquired) {
+      int64_t start = absl::GetCurrentTimeNanos();
+      if (shared) {
+        slot.mu.ReaderLock();
+      } else {
+        slot.mu.Lock();
+      }
+      int64_t wait_ns = absl::GetCurrentTimeNanos() - start;
+      slot.contended.fetch_add(1, std::memory_order_relaxed);
+      slot.total_wait_ns.fetch_add(wait_ns, std::memory_order_relaxed);
+      slot.wait_histogram[WaitHistogramBucket(wait_ns)].fetch_add(
+          1, std::memory_order_relaxed);
+    }
+    slot.acquisitions.fetch_add(1, std::memory_order_relaxed);
   }
+  slot.access.store(access, std::memory_order_relaxed);
 }
 
 void ThreadSafeCurlShare::Unlock(CURL *handle, curl_lock_data data,
@@ -324,8 +493,30 @@ void ThreadSafeCurlShare::Unlock(CURL *handle, curl_lock_data data,
   reinterpret_cast<ThreadSafeCurlShare*>(userptr)->Unlock(handle, data);
 }
 
-void ThreadSafeCurlShare::Unlock(CURL *handle, curl_lock_data data) {
-  locks_.at(data).reset(nullptr);
+void ThreadSafeCurlShare::Unlock(CURL*, curl_lock_data data) {
+  CHECK(data >= 0 && data < CURL_LOCK_DATA_LAST);
+  LockSlot &slot = locks_[data];
+  if (slot.access.load(std::memory_order_relaxed) == CURL_LOCK_ACCESS_SHARED) {
+    slot.mu.ReaderUnlock();
+  } else {
+    slot.mu.Unlock();
+  }
+}
+
+ThreadSafeCurlShare::LockStats ThreadSafeCurlShare::GetLockStats(
+    curl_lock_data data) const {
+  CHECK(data >= 0 && data < CURL_LOCK_DATA_LAST);
+  const LockSlot &slot = locks_[data];
+  LockStats stats;
+  stats.acquisitions = slot.acquisitions.load(std::memory_order_relaxed);
+  stats.contended = slot.contended.load(std::memory_order_relaxed);
+  stats.total_wait = absl::Nanoseconds(
+      slot.total_wait_ns.load(std::memory_order_relaxed));
+  for (std::size_t i = 0; i < kWaitHistogramBuckets; ++i) {
+    stats.wait_histogram[i] =
+        slot.wait_histogram[i].load(std::memory_order_relaxed);
+  }
+  return stats;
 }
 
 Status CurlEasySetWriteCallback(
@@ -343,6 +534,220 @@ Status CurlEasySetWriteCallback(
   return OkStatus();
 }
 
+Status CurlEasySetReadCallback(
+    CURL *handle, std::function<Status(absl::Span<char>, size_t*)> user_cb) {
+  auto *priv = GetPrivate(handle);
+  priv->last_read_error = OkStatus();
+  if (!user_cb) {
+    priv->read_callback = nullptr;
+    RETURN_IF_ERROR(CurlEasySetopt(handle, CURLOPT_READFUNCTION,
+                                   static_cast<curl_read_callback>(nullptr)));
+    return CurlEasySetopt(handle, CURLOPT_READDATA, stdin);
+  }
+  priv->read_callback = std::move(user_cb);
+  RETURN_IF_ERROR(CurlEasySetopt(handle, CURLOPT_READFUNCTION,
+                                 &CurlReadCallback));
+  return CurlEasySetopt(handle, CURLOPT_READDATA, priv);
+}
+
+Status CurlEasySetUpload(CURL *handle, UploadMethod method, int64_t size) {
+  switch (method) {
+    case UploadMethod::kPut:
+      RETURN_IF_ERROR(CurlEasySetopt(handle, CURLOPT_UPLOAD, 1L));
+      return CurlEasySetopt(handle, CURLOPT_INFILESIZE_LARGE,
+                            static_cast<curl_off_t>(size));
+    case UploadMethod::kPost:
+      RETURN_IF_ERROR(CurlEasySetopt(handle, CURLOPT_POST, 1L));
+      return CurlEasySetopt(handle, CURLOPT_POSTFIELDSIZE_LARGE,
+                            static_cast<curl_off_t>(size));
+  }
+  return InvalidArgumentError("Unknown UploadMethod");
+}
+
+std::size_t CurlResponseHeaders::CaseInsensitiveHash::operator()(
+    std::string_view s) const {
+  // FNV-1a.
+  uint64_t hash = 14695981039346656037ull;
+  for (char c : s) {
+    hash ^= static_cast<unsigned char>(absl::ascii_tolower(c));
+    hash *= 1099511628211ull;
+  }
+  return hash;
+}
+
+bool CurlResponseHeaders::CaseInsensitiveEq::operator()(
+    std::string_view a, std::string_view b) const {
+  return absl::EqualsIgnoreCase(a, b);
+}
+
+std::string_view CurlResponseHeaders::Store(
+    std::initializer_list<std::string_view> parts) {
+  constexpr std::size_t kMinBlockSize = 4 << 10;
+  std::size_t size = 0;
+  for (std::string_view part : parts) size += part.size();
+  while (true) {
+    if (block_ == blocks_.size()) {
+      blocks_.emplace_back();
+      blocks_.back().reserve(std::max(kMinBlockSize, size));
+    }
+    std::string &block = blocks_[block_];
+    if (block.capacity() - block.size() >= size) {
+      const std::size_t offset = block.size();
+      for (std::string_view part : parts) {
+        block.append(part.data(), part.size());
+      }
+      return {block.data() + offset, size};
+    }
+    ++block_;
+  }
+}
+
+void CurlResponseHeaders::Append(std::string_view line) {
+  while (!line.empty() && (line.back() == '\n' || line.back() == '\r')) {
+    line.remove_suffix(1);
+  }
+  if (absl::StartsWith(line, "HTTP/")) {
+    Clear();
+    status_line_ = Store({line});
+    std::string_view code = status_line_.substr(
+        std::min(status_line_.size(), status_line_.find(' ') + 1), 3);
+    if (!absl::SimpleAtoi(code, &status_code_)) status_code_ = 0;
+    return;
+  }
+  if (line.empty()) {
+    complete_ = true;
+    return;
+  }
+  if (line.front() == ' ' || line.front() == '\t') {
+    // An obsolete folded continuation of the previous header.
+    if (fields_.empty()) return;
+    Field &field = fields_.back();
+    field.value = Store({field.value, " ", absl::StripAsciiWhitespace(line)});
+    return;
+  }
+  const std::size_t colon = line.find(':');
+  if (colon == std::string_view::npos) return;
+  line = Store({line});
+  Field field;
+  field.name = line.substr(0, colon);
+  field.value = absl::StripAsciiWhitespace(line.substr(colon + 1));
+  fields_.push_back(field);
+  index_.insert_or_assign(field.name, fields_.size() - 1);
+}
+
+void CurlResponseHeaders::Clear() {
+  for (std::size_t i = 0; i <= block_ && i < blocks_.size(); ++i) {
+    blocks_[i].clear();
+  }
+  block_ = 0;
+  status_line_ = {};
+  status_code_ = 0;
+  complete_ = false;
+  fields_.clear();
+  index_.clear();
+}
+
+std::string_view CurlResponseHeaders::status_line() const {
+  return status_line_;
+}
+
+int CurlResponseHeaders::status_code() const { return status_code_; }
+
+bool CurlResponseHeaders::complete() const { return complete_; }
+
+std::optional<std::string_view> CurlResponseHeaders::Get(
+    std::string_view name) const {
+  auto it = index_.find(name);
+  if (it == index_.end()) return std::nullopt;
+  return fields_[it->second].value;
+}
+
+absl::Span<const CurlResponseHeaders::Field>
+CurlResponseHeaders::fields() const {
+  return fields_;
+}
+
+int64_t CurlResponseHeaders::content_length() const {
+  int64_t length;
+  auto value = Get("Content-Length");
+  if (!value || !absl::SimpleAtoi(*value, &length) || length < 0) return -1;
+  return length;
+}
+
+Status CurlEasyCaptureHeaders(
+    CURL *handle,
+    std::function<Status(const CurlResponseHeaders&)> on_complete) {
+  auto *priv = GetPrivate(handle);
+  if (!priv->headers) {
+    priv->headers = std::make_unique<CurlResponseHeaders>();
+  }
+  priv->headers->Clear();
+  priv->capture_headers = true;
+  priv->on_headers_complete = std::move(on_complete);
+  RETURN_IF_ERROR(CurlEasySetopt(handle, CURLOPT_HEADERFUNCTION,
+                                 &CurlHeaderCallback));
+  return CurlEasySetopt(handle, CURLOPT_HEADERDATA, priv);
+}
+
+const CurlResponseHeaders *CurlEasyGetResponseHeaders(CURL *handle) {
+  auto *priv = GetPrivate(handle);
+  return priv->capture_headers ? priv->headers.get() : nullptr;
+}
+
+void CurlCancellation::Cancel() {
+  cancelled_.store(true, std::memory_order_relaxed);
+}
+
+bool CurlCancellation::cancelled() const {
+  return cancelled_.load(std::memory_order_relaxed);
+}
+
+Status CurlEasySetContext(CURL *handle, const CurlContext &context) {
+  RETURN_IF_ERROR(CheckContext(context));
+  auto *priv = GetPrivate(handle);
+  priv->context = context;
+  priv->context_error = OkStatus();
+  long timeout_ms = 0;
+  if (context.deadline != absl::InfiniteFuture()) {
+    // Rounded up, since 0 would mean no timeout.
+    timeout_ms = std::max<int64_t>(
+        1, absl::ToInt64Milliseconds(absl::Ceil(
+               context.deadline - absl::Now(), absl::Milliseconds(1))));
+  }
+  RETURN_IF_ERROR(CurlEasySetopt(handle, CURLOPT_TIMEOUT_MS, timeout_ms));
+  RETURN_IF_ERROR(CurlEasySetopt(handle, CURLOPT_XFERINFOFUNCTION,
+                                 &CurlXferInfoCallback));
+  RETURN_IF_ERROR(CurlEasySetopt(handle, CURLOPT_XFERINFODATA, priv));
+  return CurlEasySetopt(handle, CURLOPT_NOPROGRESS, 0L);
+}
+
+std::optional<CurlContext> CurlEasyGetContext(CURL *handle) {
+  return GetPrivate(handle)->context;
+}
+
+namespace internal_curl {
+
+Status SetWriteSink(CURL *handle, curl_write_callback trampoline, void *sink) {
+  auto *priv = GetPrivate(handle);
+  priv->write_sink.sink = sink;
+  priv->write_sink.last_write_error = &priv->last_write_error;
+  RETURN_IF_ERROR(CurlEasySetopt(handle, CURLOPT_WRITEFUNCTION, trampoline));
+  RETURN_IF_ERROR(CurlEasySetopt(handle, CURLOPT_WRITEDATA, &priv->write_sink));
+  return OkStatus();
+}
+
+Status SetReadSource(CURL *handle, curl_read_callback trampoline,
+                     void *source) {
+  auto *priv = GetPrivate(handle);
+  priv->read_source.source = source;
+  priv->read_source.last_read_error = &priv->last_read_error;
+  priv->last_read_error = OkStatus();
+  RETURN_IF_ERROR(CurlEasySetopt(handle, CURLOPT_READFUNCTION, trampoline));
+  return CurlEasySetopt(handle, CURLOPT_READDATA, &priv->read_source);
+}
+
+}  // namespace internal_curl
+
 std::unique_ptr<CURL, CurlHandleDeleter> CurlEasyInit() {
   std::unique_ptr<CURL, CurlHandleDeleter> handle(curl_easy_init());
   CHECK(handle);
@@ -355,6 +760,26 @@ std::unique_ptr<CURL, CurlHandleDeleter> CurlEasyInit() {
   return handle;
 }
 
+void CurlEasyReset(CURL *handle) {
+  auto *priv = GetPrivate(handle);
+  curl_easy_reset(handle);
+  priv->write_callback = nullptr;
+  priv->write_sink = {};
+  priv->last_write_error = OkStatus();
+  priv->read_callback = nullptr;
+  priv->read_source = {};
+  priv->last_read_error = OkStatus();
+  if (priv->headers) priv->headers->Clear();
+  priv->capture_headers = false;
+  priv->on_headers_complete = nullptr;
+  priv->context.reset();
+  priv->context_error = OkStatus();
+  priv->error_buffer[0] = '\0';
+  SetPrivate(handle, priv);
+  CHECK(curl_easy_setopt(handle, CURLOPT_ERRORBUFFER,
+                         &priv->error_buffer) == CURLE_OK);
+}
+
 Status CurlCodeToStatus(CURLcode code) {
   if (code == CURLE_OK) return OkStatus();
   const char *msg = curl_easy_strerror(code);
@@ -366,6 +791,9 @@ Status CurlCodeToStatus(CURLcode code) {
     case CURLE_COULDNT_CONNECT:
       sc = StatusCode::kFailedPrecondition;
       break;
+    case CURLE_OPERATION_TIMEDOUT:
+      sc = StatusCode::kDeadlineExceeded;
+      break;
     default:
       break;
   }
@@ -439,6 +867,33 @@ Status CurlShareCodeToStatus(CURLSHcode code) {
   return {sc, msg};
 }
 
+Status CurlMultiCodeToStatus(CURLMcode code) {
+  if (code == CURLM_OK) return OkStatus();
+  const char *msg = curl_multi_strerror(code);
+  StatusCode sc = StatusCode::kUnknown;
+  switch (code) {
+    case CURLM_BAD_HANDLE:
+    case CURLM_BAD_EASY_HANDLE:
+    case CURLM_UNKNOWN_OPTION:
+      sc = StatusCode::kInvalidArgument;
+      break;
+    case CURLM_ADDED_ALREADY:
+      sc = StatusCode::kAlreadyExists;
+      break;
+    case CURLM_RECURSIVE_API_CALL:
+      sc = StatusCode::kFailedPrecondition;
+      break;
+    case CURLM_OUT_OF_MEMORY:
+    case CURLM_INTERNAL_ERROR:
+    case CURLM_BAD_SOCKET:
+      sc = StatusCode::kInternal;
+      break;
+    default:
+      break;
+  }
+  return {sc, msg};
+}
+
 Status HTTPCodeToStatus(int http_code) {
   auto code = StatusCode::kUnknown;
   if (http_code >= 200 && http_code < 300) {
@@ -481,10 +936,42 @@ Status HTTPCodeToStatus(int http_code) {
   return StatusBuilder({code, ""}) << "HTTP code " << http_code;
 }
 
-Status CurlGlobalInit() {
-  static auto *status =
-      new Status(CurlCodeToStatus(curl_global_init(CURL_GLOBAL_ALL)));
-  return *status;
+namespace {
+
+struct GlobalInitState {
+  Status status;
+  // nullptr if libcurl uses the system allocator.
+  curl_malloc_callback malloc = nullptr;
+};
+
+// Initializes libcurl on the first call, with callbacks if not null.
+const GlobalInitState &GlobalInitOnce(const CurlMemoryCallbacks *callbacks) {
+  static const auto *state = [callbacks]() {
+    auto *state = new GlobalInitState;
+    if (callbacks == nullptr) {
+      state->status = CurlCodeToStatus(curl_global_init(CURL_GLOBAL_ALL));
+    } else {
+      state->status = CurlCodeToStatus(curl_global_init_mem(
+          CURL_GLOBAL_ALL, callbacks->malloc, callbacks->free,
+          callbacks->realloc, callbacks->strdup, callbacks->calloc));
+      state->malloc = callbacks->malloc;
+    }
+    return state;
+  }();
+  return *state;
+}
+
+}  // namespace
+
+Status CurlGlobalInit() { return GlobalInitOnce(nullptr).status; }
+
+Status CurlGlobalInit(const CurlMemoryCallbacks &callbacks) {
+  const GlobalInitState &state = GlobalInitOnce(&callbacks);
+  if (state.malloc != callbacks.malloc) {
+    return FailedPreconditionError(
+        "libcurl was already initialized with other memory callbacks");
+  }
+  return state.status;
 }
 
 bool AbslParseFlag(absl::string_view text, CurlURL *url, std::string *error) {
@@ -1,17 +1,25 @@
 #ifndef RHUTIL_CURL_CURL_H_
 #define RHUTIL_CURL_CURL_H_
 
+#include <array>
+#include <atomic>
 #include <memory>
 #include <cstddef>
 #include <cstdint>
 #include <utility>
 #include <string_view>
 #include <functional>
+#include <initializer_list>
+#include <optional>
+#include <string>
+#include <vector>
 
 #include "rhutil/status.h"
 #include "curl/curl.h"
+#include "absl/base/optimization.h"
 #include "absl/types/span.h"
 #include "absl/synchronization/mutex.h"
+#include "absl/time/time.h"
 #include "absl/container/flat_hash_map.h"
 
 namespace rhutil {
@@ -37,12 +45,36 @@ class CurlShareDeleter {
   void operator()(CURLSH *);
 };
 
+class CurlMultiDeleter {
+ public:
+  void operator()(CURLM *);
+};
+
 class ThreadSafeCurlShare {
  public:
-  ThreadSafeCurlShare();
+  static constexpr std::size_t kWaitHistogramBuckets = 40;
+
+  struct LockStats {
+    uint64_t acquisitions = 0;
+    // Acquisitions which could not take the lock immediately.
+    uint64_t contended = 0;
+    absl::Duration total_wait;
+    // wait_histogram[i] counts contended acquisitions which waited for
+    // [2^i, 2^(i+1)) nanoseconds.
+    std::array<uint64_t, kWaitHistogramBuckets> wait_histogram{};
+  };
+
+  // If collect_lock_stats is false, locking costs exactly one mutex
+  // operation and GetLockStats always returns empty stats.
+  explicit ThreadSafeCurlShare(bool collect_lock_stats = false);
+
+  ThreadSafeCurlShare(const ThreadSafeCurlShare &) = delete;
+  ThreadSafeCurlShare &operator=(const ThreadSafeCurlShare &) = delete;
 
   CURLSH *ptr() const;
 
+  LockStats GetLockStats(curl_lock_data data) const;
+
  private:
   void Lock(CURL*, curl_lock_data, curl_lock_access) NO_THREAD_SAFETY_ANALYSIS;
   void Unlock(CURL*, curl_lock_data) NO_THREAD_SAFETY_ANALYSIS;
@@ -50,24 +82,23 @@ class ThreadSafeCurlShare {
   static void Lock(CURL*, curl_lock_data, curl_lock_access, void*);
   static void Unlock(CURL*, curl_lock_data, void*);
 
-  class MutexLock {
-   public:
-    virtual ~MutexLock() = 0;
+  // One per curl_lock_data, padded so that locks on different shared caches
+  // do not contend on the same cache line.
+  struct alignas(ABSL_CACHELINE_SIZE) LockSlot {
+    absl::Mutex mu;
+    // The access mode the lock is currently held with. Only written while mu
+    // is held in that mode, so all concurrent holders agree on its value.
+    std::atomic<curl_lock_access> access{CURL_LOCK_ACCESS_NONE};
+    std::atomic<uint64_t> acquisitions{0};
+    std::atomic<uint64_t> contended{0};
+    std::atomic<int64_t> total_wait_ns{0};
+    std::array<std::atomic<uint64_t>, kWaitHistogramBuckets> wait_histogram{};
   };
-  class SharedMutexLock;
-  class SingleMutexLock;
-
-  static absl::flat_hash_map<curl_lock_data, std::unique_ptr<MutexLock>>
-      CreateLocksMap();
-  static absl::flat_hash_map<curl_lock_data, std::unique_ptr<absl::Mutex>>
-      CreateMutexesMap();
 
+  const bool collect_lock_stats_;
+  // Must outlive share_, since curl_share_cleanup takes a lock.
+  std::array<LockSlot, CURL_LOCK_DATA_LAST> locks_;
   std::unique_ptr<CURLSH, CurlShareDeleter> share_;
-  // Do not modify the size or keys of this map.
-  absl::flat_hash_map<curl_lock_data, std::unique_ptr<absl::Mutex>> mutexes_;
-  // This map's values are protected by the mutexes in mutexes_. Do not modify
-  // the size or keys of this map.
-  absl::flat_hash_map<curl_lock_data, std::unique_ptr<MutexLock>> locks_;
 };
 
 // All string_views used herein must be null-terminated.
@@ -124,6 +155,11 @@ std::string AbslUnparseFlag(CurlURL url);
 
 std::unique_ptr<CURL, CurlHandleDeleter> CurlEasyInit();
 
+// Resets all options on a handle created by CurlEasyInit back to their
+// defaults (see curl_easy_reset), as well as any callbacks set through this
+// library. Live connections, the DNS cache and TLS session IDs are kept.
+void CurlEasyReset(CURL *handle);
+
 template <typename... Parameters>
 Status CurlEasySetopt(CURL *handle, CURLoption option, Parameters... params);
 template <typename... Parameters>
@@ -132,27 +168,332 @@ Status CurlEasyGetInfo(CURL *handle, CURLINFO info, Parameters... params);
 template <typename... Parameters>
 Status CurlShareSetopt(CURLSH *share, CURLSHoption option,
                        Parameters... params);
+template <typename... Parameters>
+Status CurlMultiSetopt(CURLM *multi, CURLMoption option, Parameters... params);
 
 Status CurlEasySetWriteCallback(
     CURL *handle, std::function<Status(std::string_view, size_t*)> callback);
 
+// A statically-dispatched alternative to CurlEasySetWriteCallback. Sink must
+// have a member
+//
+//   bool Write(std::string_view chunk, size_t *flags, Status *error);
+//
+// which returns true if the whole chunk was consumed (or *flags was set, e.g.
+// to CURL_WRITEFUNC_PAUSE), and otherwise sets *error and returns false. The
+// error is reported by CurlEasyPerform just like a callback error.
+//
+// The sink is not owned and must outlive the transfer. See sinks.h for
+// ready-made sinks.
+template <typename Sink>
+Status CurlEasySetWriteSink(CURL *handle, Sink *sink);
+
+// Sets the function libcurl calls for more of the request body. The callback
+// copies up to buffer.size() bytes into buffer and sets *size to the number
+// copied, to zero at the end of the body, or to CURL_READFUNC_PAUSE. An error
+// aborts the transfer and is returned by CurlEasyPerform.
+Status CurlEasySetReadCallback(
+    CURL *handle, std::function<Status(absl::Span<char>, size_t*)> callback);
+
+// A statically-dispatched alternative to CurlEasySetReadCallback, mirroring
+// CurlEasySetWriteSink. Source must have a member
+//
+//   bool Read(absl::Span<char> buffer, size_t *size, Status *error);
+//
+// which sets *size as the callback above does and returns true, or sets
+// *error and returns false.
+//
+// The source is not owned and must outlive the transfer. See sources.h for
+// ready-made sources.
+template <typename Source>
+Status CurlEasySetReadSource(CURL *handle, Source *source);
+
+// A body size for CurlEasySetUpload, meaning that it is not known up front.
+inline constexpr int64_t kUnknownBodySize = -1;
+
+enum class UploadMethod { kPut, kPost };
+
+// Makes the transfer upload size bytes from its read callback or source. If
+// size is kUnknownBodySize, HTTP/1.1 requests use chunked transfer encoding.
+Status CurlEasySetUpload(CURL *handle, UploadMethod method,
+                         int64_t size = kUnknownBodySize);
+
+// The headers of the latest response on a handle, as captured by
+// CurlEasyCaptureHeaders. Interim (1xx) responses and redirects are replaced
+// by the responses that follow them. Names match case-insensitively.
+//
+// Header lines are copied into blocks which are kept when the next response
+// starts, so a reused handle stops allocating once they are big enough. The
+// string_views returned point into those blocks, and stay valid until the
+// next response starts.
+class CurlResponseHeaders {
+ public:
+  struct Field {
+    std::string_view name;
+    std::string_view value;
+  };
+
+  CurlResponseHeaders() = default;
+  CurlResponseHeaders(const CurlResponseHeaders &) = delete;
+  CurlResponseHeaders &operator=(const CurlResponseHeaders &) = delete;
+
+  // Feeds one raw header line, as passed to a CURLOPT_HEADERFUNCTION. A
+  // status line starts a new response.
+  void Append(std::string_view line);
+  void Clear();
+
+  // e.g. "HTTP/1.1 200 OK", and 200.
+  std::string_view status_line() const;
+  int status_code() const;
+  // Whether the blank line ending the header block has arrived.
+  bool complete() const;
+
+  // The value of the last header named name.
+  std::optional<std::string_view> Get(std::string_view name) const;
+  // Every header in the order received, including repeats.
+  absl::Span<const Field> fields() const;
+  // Content-Length, or -1 if it is absent or malformed.
+  int64_t content_length() const;
+
+ private:
+  struct CaseInsensitiveHash {
+    std::size_t operator()(std::string_view s) const;
+  };
+  struct CaseInsensitiveEq {
+    bool operator()(std::string_view a, std::string_view b) const;
+  };
+
+  // Copies the concatenation of parts into the current block.
+  std::string_view Store(std::initializer_list<std::string_view> parts);
+
+  // Never grown past their capacity, so views into them stay valid.
+  std::vector<std::string> blocks_;
+  std::size_t block_ = 0;
+  std::string_view status_line_;
+  int status_code_ = 0;
+  bool complete_ = false;
+  std::vector<Field> fields_;
+  // Index into fields_ of the last header with each name.
+  absl::flat_hash_map<std::string_view, std::size_t, CaseInsensitiveHash,
+                      CaseInsensitiveEq> index_;
+};
+
+// Captures the handle's response headers, replacing any header callback.
+// on_complete, if set, is called once each final (non-1xx) response's header
+// block is complete and before any of its body arrives, e.g. to reserve room
+// for content_length() bytes. An error aborts the transfer and is returned
+// by CurlEasyPerform.
+Status CurlEasyCaptureHeaders(
+    CURL *handle,
+    std::function<Status(const CurlResponseHeaders&)> on_complete = nullptr);
+
+// The headers captured by CurlEasyCaptureHeaders, or nullptr if the handle
+// is not capturing them.
+const CurlResponseHeaders *CurlEasyGetResponseHeaders(CURL *handle);
+
+// Lets one thread cancel transfers running on others. Thread-safe.
+class CurlCancellation {
+ public:
+  CurlCancellation() = default;
+
+  CurlCancellation(const CurlCancellation &) = delete;
+  CurlCancellation &operator=(const CurlCancellation &) = delete;
+
+  void Cancel();
+  bool cancelled() const;
+
+ private:
+  std::atomic<bool> cancelled_{false};
+};
+
+// What bounds a request: a deadline, and a cancellation for when its caller
+// gives up early.
+struct CurlContext {
+  absl::Time deadline = absl::InfiniteFuture();
+  // Optional. Not owned, and must outlive the handle's transfers.
+  const CurlCancellation *cancellation = nullptr;
+};
+
+// Bounds the handle's transfers by context, until CurlEasyReset. A transfer
+// still running at the deadline, or when cancelled, is aborted (closing its
+// connection) and fails with DeadlineExceeded or Cancelled. If either has
+// already happened, this returns that error instead, so call it just before
+// starting each transfer.
+//
+// The deadline is enforced by libcurl's own timeout. Cancellation is noticed
+// when libcurl next reports progress: at once while data is flowing, and
+// otherwise within about a second under CurlEasyPerform. A CurlMulti only
+// reports progress on socket activity, so loops which need to stop an idle
+// transfer promptly should also CurlMulti::Remove it.
+Status CurlEasySetContext(CURL *handle, const CurlContext &context);
+// The context set on the handle by CurlEasySetContext, if any.
+std::optional<CurlContext> CurlEasyGetContext(CURL *handle);
+
+// Returns whether the linked libcurl was built with HTTP/2 support.
+bool CurlSupportsHTTP2();
+
+// Requests HTTP/2 for a transfer, and makes the transfer wait for an existing
+// connection to the same host to confirm whether it can multiplex rather than
+// opening a new one. https URLs negotiate HTTP/2 with ALPN and fall back to
+// HTTP/1.1. http URLs only use HTTP/2 (h2c) if prior_knowledge is set.
+Status CurlEasyEnableHTTP2(CURL *handle, bool prior_knowledge = false);
+
+// A Unix domain socket for transfers to connect to in place of TCP, e.g. to
+// reach a sidecar on the same host.
+struct CurlUnixSocket {
+  // A filesystem path or, if abstract is set, a name in Linux's abstract
+  // namespace (without the leading NUL).
+  std::string path;
+  bool abstract = false;
+
+  // "unix:" or "unix-abstract:" followed by path, or "" if path is empty.
+  std::string ToString() const;
+};
+
+// Connects the handle's transfers to socket, or over TCP again if its path is
+// empty. The URL still supplies the scheme, path and Host header, and TLS is
+// still negotiated for https. libcurl only reuses a connection for transfers
+// to the same socket.
+Status CurlEasySetUnixSocket(CURL *handle, const CurlUnixSocket &socket);
+
+// HTTP/2 stream priority. weight must be in [1, 256].
+Status CurlEasySetStreamWeight(CURL *handle, int weight);
+Status CurlEasySetStreamDependency(CURL *handle, CURL *parent,
+                                   bool exclusive = false);
+
 // The passed-in string_views must be null-terminated.
 std::unique_ptr<curl_slist, CurlSListDeleter> NewCurlSList(
     absl::Span<const std::string_view> strings);
 
+// Timing and size information about the last transfer on a handle. Times are
+// cumulative from the start of the transfer, as reported by libcurl; the
+// *Time() methods break them down into phases.
+struct TransferStats {
+  long response_code = 0;
+  long http_version = CURL_HTTP_VERSION_NONE;
+  long redirect_count = 0;
+  // False if the transfer had to open at least one new connection.
+  bool connection_reused = false;
+
+  absl::Duration name_lookup;
+  absl::Duration connect;
+  // Zero for transfers which did not perform a TLS handshake.
+  absl::Duration app_connect;
+  absl::Duration pre_transfer;
+  absl::Duration start_transfer;
+  absl::Duration total;
+  absl::Duration redirect;
+
+  int64_t bytes_downloaded = 0;
+  int64_t bytes_uploaded = 0;
+  int64_t header_bytes = 0;
+  int64_t request_bytes = 0;
+
+  absl::Duration DNSTime() const;
+  absl::Duration ConnectTime() const;
+  absl::Duration TLSTime() const;
+  // From the request being sent until the first response byte arrived.
+  absl::Duration FirstByteTime() const;
+  absl::Duration BodyTime() const;
+};
+
+StatusOr<TransferStats> CurlEasyGetTransferStats(CURL *handle);
+
 Status CurlEasyPerform(CURL *handle);
+// As above, and fills in *stats (even if the transfer failed).
+Status CurlEasyPerform(CURL *handle, TransferStats *stats);
+
+// Maps the result of a finished transfer on a handle created by CurlEasyInit
+// (including the HTTP response code and any read or write callback error) to
+// a Status, exactly as CurlEasyPerform does.
+Status CurlEasyResultToStatus(CURL *handle, CURLcode code);
 
 // Must be called before any other threads are created.
 Status CurlGlobalInit();
 
+// libcurl's memory functions, as passed to curl_global_init_mem.
+struct CurlMemoryCallbacks {
+  curl_malloc_callback malloc;
+  curl_free_callback free;
+  curl_realloc_callback realloc;
+  curl_strdup_callback strdup;
+  curl_calloc_callback calloc;
+};
+
+// As above, but libcurl allocates through callbacks. libcurl is only
+// initialized once, so this fails with FailedPrecondition if it already was
+// (by either overload) with other callbacks.
+Status CurlGlobalInit(const CurlMemoryCallbacks &callbacks);
+
 Status CurlCodeToStatus(CURLcode code);
 Status CurlCodeToStatus(CURLcode code, CURL *handle);
 Status CurlShareCodeToStatus(CURLSHcode code);
+Status CurlMultiCodeToStatus(CURLMcode code);
 
 Status HTTPCodeToStatus(int http_code);
 
 // implementation details below
 
+namespace internal_curl {
+
+struct WriteSinkContext {
+  void *sink = nullptr;
+  Status *last_write_error = nullptr;
+};
+
+Status SetWriteSink(CURL *handle, curl_write_callback trampoline, void *sink);
+
+struct ReadSourceContext {
+  void *source = nullptr;
+  Status *last_read_error = nullptr;
+};
+
+Status SetReadSource(CURL *handle, curl_read_callback trampoline,
+                     void *source);
+
+template <typename Sink>
+size_t WriteSinkTrampoline(char *ptr, size_t, size_t nmemb, void *userdata) {
+  auto *ctx = reinterpret_cast<WriteSinkContext*>(userdata);
+  size_t flags = 0;
+  if (!reinterpret_cast<Sink*>(ctx->sink)->Write(
+          {ptr, nmemb}, &flags, ctx->last_write_error)) {
+    if (ctx->last_write_error->ok()) {
+      *ctx->last_write_error = UnknownError("Write sink failed");
+    }
+    return nmemb == 0 ? 1 : 0;
+  }
+  return flags != 0 ? flags : nmemb;
+}
+
+template <typename Source>
+size_t ReadSourceTrampoline(char *buffer, size_t size, size_t nitems,
+                            void *userdata) {
+  auto *ctx = reinterpret_cast<ReadSourceContext*>(userdata);
+  size_t read = 0;
+  if (!reinterpret_cast<Source*>(ctx->source)->Read(
+          {buffer, size * nitems}, &read, ctx->last_read_error)) {
+    if (ctx->last_read_error->ok()) {
+      *ctx->last_read_error = UnknownError("Read source failed");
+    }
+    return CURL_READFUNC_ABORT;
+  }
+  return read;
+}
+
+}  // namespace internal_curl
+
+template <typename Sink>
+Status CurlEasySetWriteSink(CURL *handle, Sink *sink) {
+  return internal_curl::SetWriteSink(
+      handle, &internal_curl::WriteSinkTrampoline<Sink>, sink);
+}
+
+template <typename Source>
+Status CurlEasySetReadSource(CURL *handle, Source *source) {
+  return internal_curl::SetReadSource(
+      handle, &internal_curl::ReadSourceTrampoline<Source>, source);
+}
+
 template <typename... Parameters>
 Status CurlEasySetopt(CURL *handle, CURLoption option, Parameters... params) {
   CURLcode code = curl_easy_setopt(handle, option,
@@ -174,6 +515,13 @@ Status CurlShareSetopt(CURLSH *share, CURLSHoption option,
   return CurlShareCodeToStatus(code);
 }
 
+template <typename... Parameters>
+Status CurlMultiSetopt(CURLM *multi, CURLMoption option, Parameters... params) {
+  CURLMcode code = curl_multi_setopt(multi, option,
+                                     std::forward<Parameters>(params)...);
+  return CurlMultiCodeToStatus(code);
+}
+
 }  // namespace rhutil
 
 #endif  // RHUTIL_CURL_CURL_H_
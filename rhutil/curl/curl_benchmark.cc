@@ -0,0 +1,427 @@
+// Measures the curl wrapper against in-process loopback servers, so that
+// results reflect client overhead rather than the network. Besides time per
+// request, each benchmark reports latency percentiles and the allocations
+// made per request on the benchmark's own threads, both by C++ code
+// ("new/req") and by libcurl ("curl_allocs/req").
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "rhutil/status.h"
+#include "rhutil/curl/alloc.h"
+#include "rhutil/curl/batch.h"
+#include "rhutil/curl/curl.h"
+#include "rhutil/curl/multi.h"
+#include "rhutil/curl/sinks.h"
+#include "rhutil/curl/stream.h"
+#include "rhutil/curl/testing/loopback_server.h"
+#include "absl/strings/str_cat.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "benchmark/benchmark.h"
+
+namespace {
+
+thread_local uint64_t new_calls = 0;
+thread_local uint64_t curl_allocs = 0;
+
+}  // namespace
+
+void *operator new(std::size_t size) {
+  ++new_calls;
+  if (void *p = std::malloc(size == 0 ? 1 : size)) return p;
+  throw std::bad_alloc();
+}
+
+void *operator new[](std::size_t size) { return operator new(size); }
+
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete[](void *p) noexcept { std::free(p); }
+void operator delete(void *p, std::size_t) noexcept { std::free(p); }
+void operator delete[](void *p, std::size_t) noexcept { std::free(p); }
+
+namespace rhutil {
+namespace {
+
+// The allocator the counting callbacks forward to: the system's, unless
+// --pooled_curl_alloc is passed.
+const CurlMemoryCallbacks kSystemCallbacks = {
+    &malloc, &free, &realloc, &strdup, &calloc};
+const CurlMemoryCallbacks *curl_memory = &kSystemCallbacks;
+
+void *CountingMalloc(size_t size) {
+  ++curl_allocs;
+  return curl_memory->malloc(size);
+}
+
+void CountingFree(void *p) { curl_memory->free(p); }
+
+void *CountingCalloc(size_t nmemb, size_t size) {
+  ++curl_allocs;
+  return curl_memory->calloc(nmemb, size);
+}
+
+void *CountingRealloc(void *p, size_t size) {
+  ++curl_allocs;
+  return curl_memory->realloc(p, size);
+}
+
+char *CountingStrdup(const char *str) {
+  ++curl_allocs;
+  return curl_memory->strdup(str);
+}
+
+const LoopbackServer &HTTP1Server() {
+  static const auto *server = new LoopbackServer(&ServeHTTP1);
+  return *server;
+}
+
+const LoopbackServer &H2CServer() {
+  static const auto *server = new LoopbackServer(&ServeH2C);
+  return *server;
+}
+
+const LoopbackServer &UnixSocketServer() {
+  static const auto *server = new LoopbackServer(
+      &ServeHTTP1, absl::StrCat("/tmp/curl_benchmark.", getpid(), ".sock"));
+  return *server;
+}
+
+// Answers after a simulated round trip, for comparing concurrency against
+// sequential requests.
+const LoopbackServer &DelayedServer() {
+  static const auto *server =
+      new LoopbackServer(DelayedHTTP1(absl::Milliseconds(2)));
+  return *server;
+}
+
+// Reports per-request latency percentiles and allocation counts for one
+// benchmark thread. Counters are averaged across threads.
+class RequestRecorder {
+ public:
+  explicit RequestRecorder(benchmark::State *state) : state_(state) {
+    latencies_.reserve(1 << 16);
+  }
+
+  ~RequestRecorder() {
+    const double requests = std::max<double>(requests_, 1);
+    auto avg = [](double value) {
+      return benchmark::Counter(value, benchmark::Counter::kAvgThreads);
+    };
+    state_->counters["new/req"] = avg((new_calls - new_calls_) / requests);
+    state_->counters["curl_allocs/req"] =
+        avg((curl_allocs - curl_allocs_) / requests);
+    if (latencies_.empty()) return;
+    std::sort(latencies_.begin(), latencies_.end());
+    auto percentile = [this](double p) {
+      std::size_t index = p * (latencies_.size() - 1);
+      return absl::ToDoubleMicroseconds(latencies_[index]);
+    };
+    state_->counters["p50_us"] = avg(percentile(0.5));
+    state_->counters["p99_us"] = avg(percentile(0.99));
+    state_->counters["p999_us"] = avg(percentile(0.999));
+  }
+
+  void Record(absl::Duration latency, int requests = 1) {
+    // The vector's growth is not the wrapper's doing.
+    const uint64_t new_calls_before = new_calls;
+    latencies_.push_back(latency);
+    new_calls_ += new_calls - new_calls_before;
+    requests_ += requests;
+  }
+
+ private:
+  benchmark::State *state_;
+  std::vector<absl::Duration> latencies_;
+  uint64_t requests_ = 0;
+  uint64_t new_calls_ = new_calls;
+  uint64_t curl_allocs_ = curl_allocs;
+};
+
+std::unique_ptr<CURL, CurlHandleDeleter> NewHandle(const std::string &url) {
+  auto handle = CurlEasyInit();
+  CHECK_OK(CurlEasySetopt(handle.get(), CURLOPT_URL, url.c_str()));
+  return handle;
+}
+
+void PerformOrDie(CURL *handle, benchmark::State *state) {
+  Status status = CurlEasyPerform(handle);
+  if (!status.ok()) state->SkipWithError(status.ToString().c_str());
+}
+
+void BM_EasyInit(benchmark::State &state) {
+  RequestRecorder recorder(&state);
+  for (auto _ : state) {
+    absl::Time start = absl::Now();
+    benchmark::DoNotOptimize(CurlEasyInit());
+    recorder.Record(absl::Now() - start);
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_EasyInit);
+
+// One handle per thread, reused so that its connection is kept alive. The
+// argument is the response body size.
+void BM_PerformReusedHandle(benchmark::State &state) {
+  const std::string url = HTTP1Server().URL(absl::StrCat("/", state.range(0)));
+  std::string body;
+  auto handle = NewHandle(url);
+  StringSink sink(&body);
+  CHECK_OK(CurlEasySetWriteSink(handle.get(), &sink));
+  RequestRecorder recorder(&state);
+  for (auto _ : state) {
+    body.clear();
+    absl::Time start = absl::Now();
+    PerformOrDie(handle.get(), &state);
+    recorder.Record(absl::Now() - start);
+  }
+  state.SetItemsProcessed(state.iterations());
+  state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_PerformReusedHandle)
+    ->Arg(64)->Arg(64 << 10)->ThreadRange(1, 16)->UseRealTime();
+
+// BM_PerformReusedHandle over a Unix domain socket rather than loopback TCP.
+void BM_PerformUnixSocket(benchmark::State &state) {
+  const LoopbackServer &server = UnixSocketServer();
+  std::string body;
+  auto handle = NewHandle(server.URL(absl::StrCat("/", state.range(0))));
+  CHECK_OK(CurlEasySetUnixSocket(handle.get(), {server.unix_path()}));
+  StringSink sink(&body);
+  CHECK_OK(CurlEasySetWriteSink(handle.get(), &sink));
+  RequestRecorder recorder(&state);
+  for (auto _ : state) {
+    body.clear();
+    absl::Time start = absl::Now();
+    PerformOrDie(handle.get(), &state);
+    recorder.Record(absl::Now() - start);
+  }
+  state.SetItemsProcessed(state.iterations());
+  state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_PerformUnixSocket)
+    ->Arg(64)->Arg(64 << 10)->ThreadRange(1, 16)->UseRealTime();
+
+// A new handle per request, as in code which does not pool handles. The
+// argument selects whether the threads' handles use a ThreadSafeCurlShare,
+// which lets them reuse each other's connections and DNS results.
+void BM_PerformFreshHandle(benchmark::State &state) {
+  static auto *share = new ThreadSafeCurlShare();
+  const std::string url = HTTP1Server().URL("/64");
+  std::string body;
+  RequestRecorder recorder(&state);
+  for (auto _ : state) {
+    body.clear();
+    absl::Time start = absl::Now();
+    auto handle = NewHandle(url);
+    if (state.range(0) != 0) {
+      CHECK_OK(CurlEasySetopt(handle.get(), CURLOPT_SHARE, share->ptr()));
+    }
+    StringSink sink(&body);
+    CHECK_OK(CurlEasySetWriteSink(handle.get(), &sink));
+    PerformOrDie(handle.get(), &state);
+    recorder.Record(absl::Now() - start);
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_PerformFreshHandle)
+    ->Arg(0)->Arg(1)->ThreadRange(1, 16)->UseRealTime();
+
+// The std::function write callback, against the statically dispatched sink
+// in BM_PerformReusedHandle. Large bodies arrive in many chunks, so this
+// mostly measures per-chunk dispatch.
+void BM_WriteCallback(benchmark::State &state) {
+  const std::string url = HTTP1Server().URL(absl::StrCat("/", state.range(0)));
+  std::string body;
+  auto handle = NewHandle(url);
+  CHECK_OK(CurlEasySetWriteCallback(
+      handle.get(), [&body](std::string_view chunk, size_t*) {
+        body.append(chunk.data(), chunk.size());
+        return OkStatus();
+      }));
+  RequestRecorder recorder(&state);
+  for (auto _ : state) {
+    body.clear();
+    absl::Time start = absl::Now();
+    PerformOrDie(handle.get(), &state);
+    recorder.Record(absl::Now() - start);
+  }
+  state.SetItemsProcessed(state.iterations());
+  state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_WriteCallback)->Arg(64)->Arg(1 << 20)->UseRealTime();
+
+void BM_WriteSink(benchmark::State &state) {
+  const std::string url = HTTP1Server().URL(absl::StrCat("/", state.range(0)));
+  std::string body;
+  auto handle = NewHandle(url);
+  StringSink sink(&body);
+  CHECK_OK(CurlEasySetWriteSink(handle.get(), &sink));
+  RequestRecorder recorder(&state);
+  for (auto _ : state) {
+    body.clear();
+    absl::Time start = absl::Now();
+    PerformOrDie(handle.get(), &state);
+    recorder.Record(absl::Now() - start);
+  }
+  state.SetItemsProcessed(state.iterations());
+  state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_WriteSink)->Arg(64)->Arg(1 << 20)->UseRealTime();
+
+// Batches of concurrent requests multiplexed over one h2c connection. The
+// argument is the batch size; latency is per batch.
+void BM_MultiplexedH2C(benchmark::State &state) {
+  if (!CurlSupportsHTTP2()) {
+    state.SkipWithError("libcurl lacks HTTP/2");
+    return;
+  }
+  const std::string url = H2CServer().URL();
+  CurlMulti multi;
+  CHECK_OK(multi.EnableMultiplexing());
+  std::vector<std::unique_ptr<CURL, CurlHandleDeleter>> handles;
+  for (int i = 0; i < state.range(0); ++i) {
+    handles.push_back(NewHandle(url));
+    CHECK_OK(CurlEasyEnableHTTP2(handles.back().get(),
+                                 /*prior_knowledge=*/true));
+    CHECK_OK(CurlEasySetWriteCallback(
+        handles.back().get(),
+        [](std::string_view, size_t*) { return OkStatus(); }));
+  }
+  RequestRecorder recorder(&state);
+  for (auto _ : state) {
+    absl::Time start = absl::Now();
+    for (auto &handle : handles) {
+      CHECK_OK(multi.Add(
+          std::move(handle),
+          [&](std::unique_ptr<CURL, CurlHandleDeleter> done, Status status) {
+            if (!status.ok()) state.SkipWithError(status.ToString().c_str());
+            handles.push_back(std::move(done));
+          }));
+    }
+    handles.clear();
+    CHECK_OK(multi.Run());
+    recorder.Record(absl::Now() - start, state.range(0));
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_MultiplexedH2C)->Arg(1)->Arg(16)->Arg(64)->UseRealTime();
+
+constexpr int kBatchSize = 1000;
+
+// kBatchSize requests one after another on a reused handle, the baseline for
+// BM_Batch.
+void BM_SequentialLoop(benchmark::State &state) {
+  const std::string url = DelayedServer().URL("/64");
+  std::string body;
+  auto handle = NewHandle(url);
+  StringSink sink(&body);
+  CHECK_OK(CurlEasySetWriteSink(handle.get(), &sink));
+  RequestRecorder recorder(&state);
+  for (auto _ : state) {
+    absl::Time start = absl::Now();
+    for (int i = 0; i < kBatchSize; ++i) {
+      body.clear();
+      PerformOrDie(handle.get(), &state);
+    }
+    recorder.Record(absl::Now() - start, kBatchSize);
+  }
+  state.SetItemsProcessed(state.iterations() * kBatchSize);
+}
+BENCHMARK(BM_SequentialLoop)->Unit(benchmark::kMillisecond)->UseRealTime();
+
+// kBatchSize requests through a CurlBatch. The argument is max_concurrency;
+// latency is per batch.
+void BM_Batch(benchmark::State &state) {
+  static auto *share = new ThreadSafeCurlShare();
+  BatchRequest request;
+  request.url = DelayedServer().URL("/64");
+  const std::vector<BatchRequest> requests(kBatchSize, request);
+  CurlBatch::Options options;
+  options.max_concurrency = state.range(0);
+  options.share = share;
+  RequestRecorder recorder(&state);
+  for (auto _ : state) {
+    absl::Time start = absl::Now();
+    CurlBatch batch(requests, options);
+    batch.Run([&state](BatchResult result) {
+      if (!result.response.ok()) {
+        state.SkipWithError(result.response.status().ToString().c_str());
+      }
+    });
+    recorder.Record(absl::Now() - start, kBatchSize);
+  }
+  state.SetItemsProcessed(state.iterations() * kBatchSize);
+}
+BENCHMARK(BM_Batch)
+    ->Arg(16)->Arg(64)->Arg(256)->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+
+// Parsing an event stream delivered in chunks of the argument's size, which
+// decides how many lines are split across chunks and so copied. No network
+// is involved.
+void BM_ParseEventStream(benchmark::State &state) {
+  constexpr int kEvents = 1000;
+  std::string stream;
+  for (int i = 0; i < kEvents; ++i) {
+    absl::StrAppend(&stream, "id: ", i, "\nevent: update\ndata: {\"seq\": ",
+                    i, ", \"payload\": \"", std::string(64, 'x'), "\"}\n\n");
+  }
+  const std::size_t chunk_size = state.range(0);
+  std::size_t events = 0;
+  EventStreamParser parser([&events](const ServerSentEvent &event) {
+    benchmark::DoNotOptimize(event.data.data());
+    ++events;
+    return OkStatus();
+  });
+  for (auto _ : state) {
+    parser.Reset();
+    for (std::size_t i = 0; i < stream.size(); i += chunk_size) {
+      CHECK_OK(parser.Parse(std::string_view(stream).substr(i, chunk_size)));
+    }
+  }
+  if (events != static_cast<std::size_t>(state.iterations()) * kEvents) {
+    state.SkipWithError("Wrong number of events");
+  }
+  state.SetItemsProcessed(events);
+  state.SetBytesProcessed(state.iterations() * stream.size());
+}
+BENCHMARK(BM_ParseEventStream)->Arg(16)->Arg(1 << 10)->Arg(16 << 10);
+
+}  // namespace
+}  // namespace rhutil
+
+int main(int argc, char **argv) {
+  constexpr std::string_view kPooledFlag = "--pooled_curl_alloc";
+  const bool pooled = std::find(argv + 1, argv + argc, kPooledFlag) !=
+                      argv + argc;
+  if (pooled) {
+    rhutil::curl_memory = &rhutil::PooledCurlMemoryCallbacks();
+    argc = std::remove(argv + 1, argv + argc, kPooledFlag) - argv;
+  }
+  // Must come first, so that every libcurl allocation is counted.
+  CHECK_OK(rhutil::CurlGlobalInit(rhutil::CurlMemoryCallbacks{
+      &rhutil::CountingMalloc, &rhutil::CountingFree,
+      &rhutil::CountingRealloc, &rhutil::CountingStrdup,
+      &rhutil::CountingCalloc}));
+  benchmark::Initialize(&argc, argv);
+  if (benchmark::ReportUnrecognizedArguments(argc, argv)) return 1;
+  benchmark::RunSpecifiedBenchmarks();
+  if (pooled) {
+    rhutil::CurlAllocStats stats = rhutil::GetCurlAllocStats();
+    std::printf("libcurl peak %lu bytes, %lu in slabs\n",
+                static_cast<unsigned long>(stats.peak_bytes),
+                static_cast<unsigned long>(stats.slab_bytes));
+  }
+  return 0;
+}
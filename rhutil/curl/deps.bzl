@@ -1,6 +1,45 @@
 load("@bazel_tools//tools/build_defs/repo:http.bzl", "http_archive")
 
-def rhutil_curl_deps():
+NGHTTP2_VERSION = "1.39.2"
+
+# The sha256 of nghttp2-$NGHTTP2_VERSION.tar.gz. Must be filled in from the
+# release tarball (sha256sum, or the canonical form `bazel sync` prints) when
+# NGHTTP2_VERSION changes. Until it is, nghttp2 is not fetched and curl is
+# built without HTTP/2, rather than from unverified code.
+NGHTTP2_SHA256 = ""
+
+def _nghttp2_unavailable_impl(repository_ctx):
+  repository_ctx.file("WORKSPACE", "workspace(name = \"nghttp2\")\n")
+  # Without USE_NGHTTP2, which the real library defines, curl leaves out
+  # HTTP/2 and CurlSupportsHTTP2 returns false.
+  repository_ctx.file("BUILD", "\n".join([
+      "package(default_visibility = [\"//visibility:public\"])",
+      "",
+      "cc_library(name = \"nghttp2\")",
+      "",
+  ]))
+
+_nghttp2_unavailable = repository_rule(
+    implementation = _nghttp2_unavailable_impl,
+)
+
+def rhutil_curl_deps(nghttp2_sha256 = NGHTTP2_SHA256):
+  if not native.existing_rule("nghttp2"):
+    if nghttp2_sha256:
+      http_archive(
+          name = "nghttp2",
+          build_file = "@rhutil//third_party:nghttp2.BUILD",
+          sha256 = nghttp2_sha256,
+          strip_prefix = "nghttp2-%s" % NGHTTP2_VERSION,
+          urls = ["https://github.com/nghttp2/nghttp2/releases/download/v{0}/nghttp2-{0}.tar.gz".format(NGHTTP2_VERSION)],
+      )
+    else:
+      print("nghttp2 %s has no pinned sha256, so curl is built without " %
+            NGHTTP2_VERSION + "HTTP/2; set NGHTTP2_SHA256 in " +
+            "rhutil/curl/deps.bzl, or pass nghttp2_sha256 to " +
+            "rhutil_curl_deps")
+      _nghttp2_unavailable(name = "nghttp2")
+
   if not native.existing_rule("curl"):
     http_archive(
         name = "curl",
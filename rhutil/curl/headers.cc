@@ -0,0 +1,122 @@
+#include "rhutil/curl/headers.h"
+
+#include <utility>
+
+#include "rhutil/curl/curl.h"
+#include "absl/strings/ascii.h"
+#include "absl/strings/match.h"
+
+namespace rhutil {
+namespace {
+
+// The name of a header in any of CURLOPT_HTTPHEADER's forms.
+StatusOr<std::string_view> HeaderName(std::string_view header) {
+  if (header.find_first_of("\r\n") != std::string_view::npos) {
+    return InvalidArgumentErrorBuilder()
+        << "Header contains a line break: '" << header << "'";
+  }
+  std::string_view name = absl::StripAsciiWhitespace(
+      header.substr(0, header.find_first_of(":;")));
+  if (name.empty() || name.size() == header.size()) {
+    return InvalidArgumentErrorBuilder()
+        << "Header has no name: '" << header << "'";
+  }
+  return name;
+}
+
+// curl_slist's data is not const, but libcurl only reads request headers.
+curl_slist Node(const std::string &header) {
+  return {const_cast<char*>(header.c_str()), nullptr};
+}
+
+}  // namespace
+
+StatusOr<std::shared_ptr<const CurlHeaderSet>> CurlHeaderSet::Create(
+    absl::Span<const std::string_view> headers) {
+  std::shared_ptr<CurlHeaderSet> set(new CurlHeaderSet());
+  set->headers_.reserve(headers.size());
+  for (std::string_view header : headers) {
+    set->headers_.emplace_back(header.data(), header.size());
+  }
+  // headers_ no longer changes, so views into it stay valid.
+  for (const std::string &header : set->headers_) {
+    ASSIGN_OR_RETURN(std::string_view name, HeaderName(header));
+    set->names_.push_back(name);
+    set->nodes_.push_back(Node(header));
+  }
+  for (std::size_t i = 1; i < set->nodes_.size(); ++i) {
+    set->nodes_[i - 1].next = &set->nodes_[i];
+  }
+  return std::shared_ptr<const CurlHeaderSet>(std::move(set));
+}
+
+Status CurlHeaderSet::Apply(CURL *handle) const {
+  return CurlEasySetopt(handle, CURLOPT_HTTPHEADER, list());
+}
+
+const curl_slist *CurlHeaderSet::list() const {
+  return nodes_.empty() ? nullptr : &nodes_.front();
+}
+
+std::size_t CurlHeaderSet::size() const { return nodes_.size(); }
+
+CurlRequestHeaders::CurlRequestHeaders(
+    std::shared_ptr<const CurlHeaderSet> base)
+  : base_(std::move(base)) {}
+
+Status CurlRequestHeaders::Override(std::string_view header) {
+  ASSIGN_OR_RETURN(std::string_view name, HeaderName(header));
+  std::size_t i = 0;
+  while (i < num_overrides_ &&
+         !absl::EqualsIgnoreCase(override_names_[i], name)) {
+    ++i;
+  }
+  if (i == num_overrides_) {
+    if (num_overrides_ == overrides_.size()) {
+      overrides_.emplace_back();
+      override_names_.emplace_back();
+    }
+    ++num_overrides_;
+  }
+  overrides_[i].assign(header.data(), header.size());
+  override_names_[i] = HeaderName(overrides_[i]).ValueOrDie();
+  return OkStatus();
+}
+
+void CurlRequestHeaders::ClearOverrides() { num_overrides_ = 0; }
+
+bool CurlRequestHeaders::IsOverridden(std::string_view name) const {
+  for (std::size_t i = 0; i < num_overrides_; ++i) {
+    if (absl::EqualsIgnoreCase(override_names_[i], name)) return true;
+  }
+  return false;
+}
+
+Status CurlRequestHeaders::Apply(CURL *handle) {
+  if (num_overrides_ == 0) return base_->Apply(handle);
+
+  // Set headers up to the last overridden one are relinked, skipping the
+  // overridden ones, and the rest of the set is shared as is.
+  const std::size_t base_size = base_->size();
+  std::size_t shared_from = 0;
+  for (std::size_t i = 0; i < base_size; ++i) {
+    if (IsOverridden(base_->names_[i])) shared_from = i + 1;
+  }
+
+  nodes_.clear();
+  for (std::size_t i = 0; i < num_overrides_; ++i) {
+    nodes_.push_back(Node(overrides_[i]));
+  }
+  for (std::size_t i = 0; i < shared_from; ++i) {
+    if (!IsOverridden(base_->names_[i])) nodes_.push_back(base_->nodes_[i]);
+  }
+  // nodes_ is complete, so its elements no longer move.
+  for (std::size_t i = 1; i < nodes_.size(); ++i) {
+    nodes_[i - 1].next = &nodes_[i];
+  }
+  nodes_.back().next = shared_from < base_size
+      ? const_cast<curl_slist*>(&base_->nodes_[shared_from]) : nullptr;
+  return CurlEasySetopt(handle, CURLOPT_HTTPHEADER, nodes_.data());
+}
+
+}  // namespace rhutil
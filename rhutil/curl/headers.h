@@ -0,0 +1,91 @@
+#ifndef RHUTIL_CURL_HEADERS_H_
+#define RHUTIL_CURL_HEADERS_H_
+
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "rhutil/status.h"
+#include "curl/curl.h"
+#include "absl/types/span.h"
+
+namespace rhutil {
+
+// An immutable list of request headers, built once and then attached to any
+// number of handles on any number of threads without copying. Headers take
+// the forms CURLOPT_HTTPHEADER accepts, e.g. "Name: value", "Name:" to drop
+// a header libcurl would add, or "Name;" for an empty one.
+class CurlHeaderSet {
+ public:
+  // Fails with InvalidArgument if a header has no name or contains a line
+  // break.
+  static StatusOr<std::shared_ptr<const CurlHeaderSet>> Create(
+      absl::Span<const std::string_view> headers);
+
+  CurlHeaderSet(const CurlHeaderSet &) = delete;
+  CurlHeaderSet &operator=(const CurlHeaderSet &) = delete;
+
+  // Sets CURLOPT_HTTPHEADER. The set must outlive the handle's transfers.
+  Status Apply(CURL *handle) const;
+
+  // nullptr if the set is empty.
+  const curl_slist *list() const;
+  std::size_t size() const;
+
+ private:
+  friend class CurlRequestHeaders;
+
+  CurlHeaderSet() = default;
+
+  std::vector<std::string> headers_;
+  // Views into headers_.
+  std::vector<std::string_view> names_;
+  // Linked in order, pointing into headers_.
+  std::vector<curl_slist> nodes_;
+};
+
+// A handle's request headers: a shared CurlHeaderSet, with per-request
+// overrides layered on top which replace the set's headers of the same name.
+//
+// Applying overrides links them in front of the shared list. Only set headers
+// that precede the last overridden one are relinked, and none are copied, so
+// placing frequently overridden headers first in the set keeps this cheap.
+// Overrides keep their storage when cleared, so a reused CurlRequestHeaders
+// stops allocating.
+//
+// Not thread-safe. It must outlive the transfers it is applied to.
+class CurlRequestHeaders {
+ public:
+  explicit CurlRequestHeaders(std::shared_ptr<const CurlHeaderSet> base);
+
+  CurlRequestHeaders(const CurlRequestHeaders &) = delete;
+  CurlRequestHeaders &operator=(const CurlRequestHeaders &) = delete;
+
+  // Adds header, replacing any earlier override and any header in the set
+  // with the same name. header takes the same forms as in CurlHeaderSet.
+  Status Override(std::string_view header);
+  void ClearOverrides();
+
+  // Sets CURLOPT_HTTPHEADER to the set with the overrides applied. Changing
+  // the overrides afterwards requires applying them again.
+  Status Apply(CURL *handle);
+
+ private:
+  bool IsOverridden(std::string_view name) const;
+
+  std::shared_ptr<const CurlHeaderSet> base_;
+  // Only the first num_overrides_ are in use. A deque, so that growing it
+  // does not move the strings override_names_ points into.
+  std::deque<std::string> overrides_;
+  // Views into overrides_.
+  std::vector<std::string_view> override_names_;
+  std::size_t num_overrides_ = 0;
+  std::vector<curl_slist> nodes_;
+};
+
+}  // namespace rhutil
+
+#endif  // RHUTIL_CURL_HEADERS_H_
@@ -0,0 +1,107 @@
+#include "rhutil/curl/hedge.h"
+
+#include <algorithm>
+#include <cmath>
+#include <utility>
+
+#include "rhutil/curl/multi.h"
+#include "absl/time/clock.h"
+
+namespace rhutil {
+
+Hedger::Hedger() : Hedger(Options()) {}
+
+Hedger::Hedger(Options options)
+  : options_(std::move(options)),
+    budget_(options_.max_hedge_ratio, options_.max_hedge_burst) {
+  latencies_.reserve(std::max<std::size_t>(options_.window, 1));
+}
+
+absl::Duration Hedger::HedgeDelay() const {
+  std::vector<absl::Duration> latencies;
+  {
+    absl::MutexLock lock(&mu_);
+    if (latencies_.empty() || latencies_.size() < options_.min_samples) {
+      return options_.initial_delay;
+    }
+    latencies = latencies_;
+  }
+  // The nearest-rank percentile, which is always an observed latency.
+  const double rank = std::ceil(
+      std::clamp(options_.percentile, 0.0, 100.0) / 100 * latencies.size());
+  const std::size_t index = std::max<std::size_t>(rank, 1) - 1;
+  std::nth_element(latencies.begin(), latencies.begin() + index,
+                   latencies.end());
+  return std::max(options_.min_delay, latencies[index]);
+}
+
+void Hedger::RecordLatency(absl::Duration latency) {
+  absl::MutexLock lock(&mu_);
+  if (latencies_.size() < std::max<std::size_t>(options_.window, 1)) {
+    latencies_.push_back(latency);
+    return;
+  }
+  latencies_[next_latency_] = latency;
+  next_latency_ = (next_latency_ + 1) % latencies_.size();
+}
+
+StatusOr<Hedger::Result> Hedger::Perform(const HandleFactory &make_handle) {
+  const absl::Duration delay = HedgeDelay();
+  CurlMulti multi;
+  Result result;
+  bool done = false;
+  int sent = 0;
+  // Cleared once the budget refuses a hedge.
+  bool hedging = true;
+  budget_.RecordRequest();
+  const absl::Time start = absl::Now();
+
+  auto send = [&]() -> Status {
+    auto handle = make_handle(sent);
+    if (!handle) return InternalError("HandleFactory returned no handle");
+    const bool hedged = sent > 0;
+    ++sent;
+    return multi.Add(
+        std::move(handle),
+        [&, hedged](std::unique_ptr<CURL, CurlHandleDeleter> handle,
+                    Status status) {
+          if (done) return;
+          if (status.ok()) {
+            // The time since the original was sent, which when a hedge wins
+            // is a lower bound on the original's latency. Recording only the
+            // hedge's own latency would drop the slow requests which hedging
+            // hid, pulling the delay down and sending ever more hedges.
+            RecordLatency(absl::Now() - start);
+            done = true;
+          }
+          result.handle = std::move(handle);
+          result.status = std::move(status);
+          result.hedged = hedged;
+        });
+  };
+
+  RETURN_IF_ERROR(send());
+  absl::Time next_hedge = absl::Now() + delay;
+  while (!done && !multi.empty()) {
+    const bool can_hedge = hedging && sent <= options_.max_hedges;
+    absl::Duration timeout = absl::InfiniteDuration();
+    if (can_hedge) {
+      timeout = std::max(next_hedge - absl::Now(), absl::ZeroDuration());
+    }
+    RETURN_IF_ERROR(multi.Poll(timeout));
+    if (done || multi.empty()) break;
+    if (can_hedge && absl::Now() >= next_hedge) {
+      if (!budget_.TryWithdraw()) {
+        hedging = false;
+        continue;
+      }
+      RETURN_IF_ERROR(send());
+      next_hedge += delay;
+    }
+  }
+  // Any requests still in flight are cancelled when multi is destroyed.
+  if (!result.handle) return InternalError("No hedged request finished");
+  return result;
+}
+
+}  // namespace rhutil
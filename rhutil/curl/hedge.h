@@ -0,0 +1,82 @@
+#ifndef RHUTIL_CURL_HEDGE_H_
+#define RHUTIL_CURL_HEDGE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <functional>
+#include <vector>
+
+#include "rhutil/status.h"
+#include "rhutil/curl/curl.h"
+#include "rhutil/curl/retry.h"
+#include "absl/time/time.h"
+#include "absl/synchronization/mutex.h"
+
+namespace rhutil {
+
+// Issues hedged requests: if a request has not finished after the configured
+// percentile of the most recent latencies, an identical request is sent and
+// whichever finishes first wins, while the other is cancelled. Only use this
+// for idempotent requests. Thread-safe.
+class Hedger {
+ public:
+  struct Options {
+    // The percentile of observed latencies after which a hedge is sent.
+    double percentile = 95;
+    // How many of the most recent latencies the percentile is taken over, so
+    // that the delay follows changes in latency.
+    std::size_t window = 1000;
+    // Used as the hedge delay until min_samples latencies have been observed.
+    absl::Duration initial_delay = absl::Milliseconds(100);
+    uint64_t min_samples = 20;
+    absl::Duration min_delay = absl::Milliseconds(1);
+    // Hedges sent per request, not counting the original.
+    int max_hedges = 1;
+    // Hedges are limited to about this fraction of requests, plus a burst of
+    // up to max_hedge_burst, so that a spike in latency cannot double the
+    // load on a backend. See RetryBudget.
+    double max_hedge_ratio = 0.1;
+    double max_hedge_burst = 10;
+  };
+
+  struct Result {
+    // The handle of the request which won.
+    std::unique_ptr<CURL, CurlHandleDeleter> handle;
+    Status status;
+    // Whether the winner was a hedge rather than the original request.
+    bool hedged = false;
+  };
+
+  // Returns a fully configured handle created by CurlEasyInit. Each handle
+  // must write to its own sink. attempt is 0 for the original request.
+  using HandleFactory =
+      std::function<std::unique_ptr<CURL, CurlHandleDeleter>(int attempt)>;
+
+  Hedger();
+  explicit Hedger(Options options);
+
+  Hedger(const Hedger &) = delete;
+  Hedger &operator=(const Hedger &) = delete;
+
+  // Blocks until one of the requests succeeds, or all of them have failed (in
+  // which case the result of the last to fail is returned).
+  StatusOr<Result> Perform(const HandleFactory &make_handle);
+
+  absl::Duration HedgeDelay() const;
+
+ private:
+  void RecordLatency(absl::Duration latency);
+
+  const Options options_;
+  RetryBudget budget_;
+  mutable absl::Mutex mu_;
+  // The latencies of the last options_.window requests, used as a ring
+  // buffer once full.
+  std::vector<absl::Duration> latencies_ GUARDED_BY(mu_);
+  std::size_t next_latency_ GUARDED_BY(mu_) = 0;
+};
+
+}  // namespace rhutil
+
+#endif  // RHUTIL_CURL_HEDGE_H_
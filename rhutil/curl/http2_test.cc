@@ -0,0 +1,83 @@
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "rhutil/curl/curl.h"
+#include "rhutil/curl/multi.h"
+#include "rhutil/curl/testing/loopback_server.h"
+#include "rhutil/testing/assertions.h"
+#include "gtest/gtest.h"
+
+namespace rhutil {
+namespace {
+
+class HTTP2Test : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    ASSERT_TRUE(IsOk(CurlGlobalInit()));
+    if (!CurlSupportsHTTP2()) GTEST_SKIP() << "libcurl lacks HTTP/2";
+  }
+};
+
+std::unique_ptr<CURL, CurlHandleDeleter> NewH2CHandle(const std::string &url,
+                                                      std::string *body) {
+  auto handle = CurlEasyInit();
+  CHECK_OK(CurlEasySetopt(handle.get(), CURLOPT_URL, url.c_str()));
+  CHECK_OK(CurlEasyEnableHTTP2(handle.get(), /*prior_knowledge=*/true));
+  CHECK_OK(CurlEasySetWriteCallback(
+      handle.get(), [body](std::string_view chunk, size_t*) {
+        body->append(chunk.data(), chunk.size());
+        return OkStatus();
+      }));
+  return handle;
+}
+
+TEST_F(HTTP2Test, PriorKnowledge) {
+  LoopbackServer server(&ServeH2C);
+  std::string body;
+  auto handle = NewH2CHandle(server.URL(), &body);
+  ASSERT_TRUE(IsOk(CurlEasyPerform(handle.get())));
+  EXPECT_EQ(body, kLoopbackBody);
+
+  long version = 0;
+  ASSERT_TRUE(IsOk(CurlEasyGetInfo(handle.get(), CURLINFO_HTTP_VERSION,
+                                   &version)));
+  EXPECT_EQ(version, CURL_HTTP_VERSION_2_0);
+}
+
+TEST_F(HTTP2Test, MultiplexesConcurrentTransfers) {
+  constexpr int kTransfers = 16;
+  LoopbackServer server(&ServeH2C);
+  CurlMulti multi;
+  ASSERT_TRUE(IsOk(multi.EnableMultiplexing()));
+
+  std::vector<std::string> bodies(kTransfers);
+  int succeeded = 0;
+  for (int i = 0; i < kTransfers; ++i) {
+    auto handle =
+        NewH2CHandle(server.URL("/" + std::to_string(i)), &bodies[i]);
+    ASSERT_TRUE(IsOk(CurlEasySetStreamWeight(handle.get(), 1 + i * 16)));
+    ASSERT_TRUE(IsOk(multi.Add(
+        std::move(handle),
+        [&](std::unique_ptr<CURL, CurlHandleDeleter>, Status st) {
+          EXPECT_TRUE(IsOk(st));
+          if (st.ok()) ++succeeded;
+        })));
+  }
+  ASSERT_TRUE(IsOk(multi.Run()));
+
+  EXPECT_EQ(succeeded, kTransfers);
+  for (const std::string &body : bodies) EXPECT_EQ(body, kLoopbackBody);
+  EXPECT_EQ(server.connections(), 1);
+}
+
+TEST_F(HTTP2Test, StreamWeightOutOfRange) {
+  auto handle = CurlEasyInit();
+  EXPECT_EQ(CurlEasySetStreamWeight(handle.get(), 0).code(),
+            StatusCode::kInvalidArgument);
+  EXPECT_EQ(CurlEasySetStreamWeight(handle.get(), 257).code(),
+            StatusCode::kInvalidArgument);
+}
+
+}  // namespace
+}  // namespace rhutil
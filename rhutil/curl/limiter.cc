@@ -0,0 +1,242 @@
+#include "rhutil/curl/limiter.h"
+
+#include <algorithm>
+#include <cmath>
+#include <utility>
+
+namespace rhutil {
+
+HostLimiter::Permit::Permit() : limiter_(nullptr) {}
+
+HostLimiter::Permit::Permit(HostLimiter *limiter, std::string host,
+                            absl::Time admitted)
+  : limiter_(limiter), host_(std::move(host)), admitted_(admitted) {}
+
+HostLimiter::Permit::~Permit() {
+  if (limiter_ != nullptr) limiter_->Release(host_, admitted_, nullptr);
+}
+
+HostLimiter::Permit::Permit(Permit &&o)
+  : limiter_(std::exchange(o.limiter_, nullptr)), host_(std::move(o.host_)),
+    admitted_(o.admitted_) {}
+
+HostLimiter::Permit &HostLimiter::Permit::operator=(Permit &&o) {
+  if (this == &o) return *this;
+  if (limiter_ != nullptr) limiter_->Release(host_, admitted_, nullptr);
+  limiter_ = std::exchange(o.limiter_, nullptr);
+  host_ = std::move(o.host_);
+  admitted_ = o.admitted_;
+  return *this;
+}
+
+HostLimiter::Permit::operator bool() const { return limiter_ != nullptr; }
+
+void HostLimiter::Permit::Done(const Status &status) {
+  if (limiter_ == nullptr) return;
+  std::exchange(limiter_, nullptr)->Release(host_, admitted_, &status);
+}
+
+HostLimiter::HostLimiter() : HostLimiter(Options()) {}
+
+HostLimiter::HostLimiter(Options options) : options_(std::move(options)) {}
+
+HostLimiter::HostState &HostLimiter::GetHostLocked(std::string_view host,
+                                                   absl::Time now) {
+  auto it = hosts_.find(host);
+  if (it != hosts_.end()) return it->second;
+  HostState &state = hosts_[std::string(host)];
+  state.tokens = std::max(options_.burst, 1.0);
+  state.refilled = now;
+  if (options_.adaptive) {
+    state.limit = std::max(options_.initial_in_flight, options_.min_in_flight);
+    if (options_.max_in_flight > 0) {
+      state.limit = std::min<double>(state.limit, options_.max_in_flight);
+    }
+  } else {
+    state.limit = options_.max_in_flight;
+  }
+  state.stats.limit = state.limit;
+  return state;
+}
+
+bool HostLimiter::TryAdmitLocked(HostState *state, absl::Time now,
+                                 absl::Duration *retry_in) {
+  const double rate = options_.requests_per_second;
+  if (rate > 0) {
+    state->tokens = std::min(
+        std::max(options_.burst, 1.0),
+        state->tokens + absl::ToDoubleSeconds(now - state->refilled) * rate);
+  }
+  state->refilled = now;
+
+  const int limit = std::floor(state->limit);
+  if (limit > 0 && state->in_flight >= limit) {
+    *retry_in = absl::InfiniteDuration();
+    return false;
+  }
+  if (rate > 0) {
+    if (state->tokens < 1) {
+      *retry_in = absl::Seconds((1 - state->tokens) / rate);
+      return false;
+    }
+    state->tokens -= 1;
+  }
+  ++state->in_flight;
+  ++state->stats.admitted;
+  return true;
+}
+
+HostLimiter::Permit HostLimiter::Acquire(std::string_view host) {
+  StatusOr<Permit> permit = Acquire(host, absl::InfiniteFuture());
+  CHECK_OK(permit.status());
+  return std::move(permit).ValueOrDie();
+}
+
+StatusOr<HostLimiter::Permit> HostLimiter::Acquire(std::string_view host,
+                                                   absl::Time deadline) {
+  absl::MutexLock lock(&mu_);
+  bool delayed = false;
+  while (true) {
+    const absl::Time now = absl::Now();
+    HostState &state = GetHostLocked(host, now);
+    absl::Duration retry_in;
+    if (TryAdmitLocked(&state, now, &retry_in)) {
+      if (delayed) ++state.stats.delayed;
+      return Permit(this, std::string(host), now);
+    }
+    if (now >= deadline) {
+      return StatusBuilder(DeadlineExceededError("Timed out waiting for "))
+          << host << " to admit a request";
+    }
+    delayed = true;
+    // Woken early whenever any request is released, in case it was for host.
+    released_.WaitWithDeadline(&mu_, std::min(deadline, now + retry_in));
+  }
+}
+
+bool HostLimiter::TryAcquire(std::string_view host, Permit *permit,
+                             absl::Duration *retry_in) {
+  const absl::Time now = absl::Now();
+  {
+    absl::MutexLock lock(&mu_);
+    HostState &state = GetHostLocked(host, now);
+    if (!TryAdmitLocked(&state, now, retry_in)) {
+      ++state.stats.delayed;
+      return false;
+    }
+  }
+  // Outside the lock, since replacing a live permit releases it.
+  *permit = Permit(this, std::string(host), now);
+  return true;
+}
+
+Status HostLimiter::Perform(CURL *handle, std::string_view host) {
+  Permit permit = Acquire(host);
+  Status status = CurlEasyPerform(handle);
+  permit.Done(status);
+  return status;
+}
+
+void HostLimiter::Release(const std::string &host, absl::Time admitted,
+                          const Status *status) {
+  absl::MutexLock lock(&mu_);
+  auto it = hosts_.find(host);
+  CHECK(it != hosts_.end());
+  HostState &state = it->second;
+  --state.in_flight;
+  if (status != nullptr && options_.adaptive) {
+    const absl::Time now = absl::Now();
+    const bool overloaded =
+        status->code() == StatusCode::kResourceExhausted ||
+        status->code() == StatusCode::kUnavailable ||
+        now - admitted > options_.latency_target;
+    if (overloaded) {
+      ++state.stats.overloads;
+      if (admitted > state.last_decrease) {
+        state.limit = std::max<double>(
+            options_.min_in_flight, state.limit * options_.decrease_factor);
+        state.last_decrease = now;
+      }
+    } else {
+      // Grows by about one per limit's worth of successful requests.
+      state.limit += 1 / state.limit;
+      if (options_.max_in_flight > 0) {
+        state.limit = std::min<double>(state.limit, options_.max_in_flight);
+      }
+    }
+    state.stats.limit = state.limit;
+  }
+  released_.SignalAll();
+}
+
+HostLimiter::HostStats HostLimiter::GetHostStats(
+    std::string_view host) const {
+  absl::MutexLock lock(&mu_);
+  auto it = hosts_.find(host);
+  if (it == hosts_.end()) return HostStats();
+  HostStats stats = it->second.stats;
+  stats.in_flight = it->second.in_flight;
+  return stats;
+}
+
+AdmissionQueue::AdmissionQueue(CurlMulti *multi, HostLimiter *limiter)
+  : multi_(multi), limiter_(limiter) {}
+
+void AdmissionQueue::Add(std::string host,
+                         std::unique_ptr<CURL, CurlHandleDeleter> handle,
+                         CurlMulti::DoneCallback done) {
+  queued_[std::move(host)].push_back({std::move(handle), std::move(done)});
+  ++size_;
+}
+
+StatusOr<absl::Duration> AdmissionQueue::Pump() {
+  absl::Duration next = absl::InfiniteDuration();
+  for (auto it = queued_.begin(); it != queued_.end();) {
+    std::deque<Queued> &queue = it->second;
+    while (!queue.empty()) {
+      HostLimiter::Permit permit;
+      absl::Duration retry_in;
+      if (!limiter_->TryAcquire(it->first, &permit, &retry_in)) {
+        next = std::min(next, retry_in);
+        break;
+      }
+      Queued transfer = std::move(queue.front());
+      queue.pop_front();
+      --size_;
+      // DoneCallback must be copyable, and Permit is not.
+      auto shared_permit =
+          std::make_shared<HostLimiter::Permit>(std::move(permit));
+      RETURN_IF_ERROR(multi_->Add(
+          std::move(transfer.handle),
+          [shared_permit, done = std::move(transfer.done)](
+              std::unique_ptr<CURL, CurlHandleDeleter> handle, Status status) {
+            shared_permit->Done(status);
+            if (done) done(std::move(handle), std::move(status));
+          }));
+    }
+    if (queue.empty()) {
+      queued_.erase(it++);
+    } else {
+      ++it;
+    }
+  }
+  return next;
+}
+
+Status AdmissionQueue::Run() {
+  while (size_ != 0 || !multi_->empty()) {
+    ASSIGN_OR_RETURN(absl::Duration timeout, Pump());
+    // With nothing of ours in flight, the slots we are waiting for are held
+    // elsewhere (e.g. by another thread), and releasing them will not wake
+    // Poll.
+    if (multi_->empty() && timeout == absl::InfiniteDuration()) {
+      timeout = absl::Milliseconds(10);
+    }
+    RETURN_IF_ERROR(multi_->Poll(timeout));
+  }
+  return OkStatus();
+}
+
+std::size_t AdmissionQueue::queued() const { return size_; }
+
+}  // namespace rhutil
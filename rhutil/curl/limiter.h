@@ -0,0 +1,170 @@
+#ifndef RHUTIL_CURL_LIMITER_H_
+#define RHUTIL_CURL_LIMITER_H_
+
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <string>
+#include <string_view>
+
+#include "rhutil/status.h"
+#include "rhutil/curl/curl.h"
+#include "rhutil/curl/multi.h"
+#include "absl/time/time.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/container/flat_hash_map.h"
+
+namespace rhutil {
+
+// Per-host admission control: a cap on requests in flight, a token bucket on
+// the request rate and, optionally, an AIMD limit which backs off when the
+// host signals overload. Hosts are arbitrary keys, typically
+// scheme://host:port (see CurlHandlePool::KeyFor). Thread-safe.
+class HostLimiter {
+ public:
+  struct Options {
+    // Requests in flight per host. 0 means unlimited, unless adaptive is set.
+    int max_in_flight = 0;
+    // Sustained requests per second per host, and the largest burst. 0 means
+    // unlimited.
+    double requests_per_second = 0;
+    double burst = 1;
+
+    // Additive-increase/multiplicative-decrease of the in-flight limit, which
+    // then varies between min_in_flight and max_in_flight. A response counts
+    // as overload if its status is ResourceExhausted (429) or Unavailable
+    // (503), or if it took longer than latency_target.
+    bool adaptive = false;
+    int min_in_flight = 1;
+    int initial_in_flight = 8;
+    absl::Duration latency_target = absl::InfiniteDuration();
+    double decrease_factor = 0.5;
+  };
+
+  struct HostStats {
+    int in_flight = 0;
+    // The current in-flight limit (0 if unlimited).
+    double limit = 0;
+    uint64_t admitted = 0;
+    // Acquires which had to wait, plus TryAcquires which were refused.
+    uint64_t delayed = 0;
+    uint64_t overloads = 0;
+  };
+
+  // Admission for one request. Releases its slot when destroyed; call Done
+  // first to feed the outcome into the adaptive limit.
+  class Permit {
+   public:
+    Permit();
+    ~Permit();
+
+    Permit(Permit &&);
+    Permit &operator=(Permit &&);
+    Permit(const Permit &) = delete;
+    Permit &operator=(const Permit &) = delete;
+
+    explicit operator bool() const;
+
+    // status is the result of the request, e.g. from CurlEasyPerform.
+    void Done(const Status &status);
+
+   private:
+    friend class HostLimiter;
+    Permit(HostLimiter *limiter, std::string host, absl::Time admitted);
+
+    HostLimiter *limiter_;
+    std::string host_;
+    absl::Time admitted_;
+  };
+
+  HostLimiter();
+  explicit HostLimiter(Options options);
+
+  HostLimiter(const HostLimiter &) = delete;
+  HostLimiter &operator=(const HostLimiter &) = delete;
+
+  // Blocks until host admits another request.
+  Permit Acquire(std::string_view host);
+  // As above, but gives up with DeadlineExceeded at deadline.
+  StatusOr<Permit> Acquire(std::string_view host, absl::Time deadline);
+
+  // Does not block, for event loops. If host admits a request now, sets
+  // *permit and returns true. Otherwise sets *retry_in to how long until a
+  // token is due, or to absl::InfiniteDuration() if the host is waiting for
+  // a request in flight to finish.
+  bool TryAcquire(std::string_view host, Permit *permit,
+                  absl::Duration *retry_in);
+
+  // CurlEasyPerform, once host admits the request.
+  Status Perform(CURL *handle, std::string_view host);
+
+  HostStats GetHostStats(std::string_view host) const;
+
+ private:
+  struct HostState {
+    int in_flight = 0;
+    double limit = 0;
+    double tokens = 0;
+    absl::Time refilled;
+    // Only requests admitted after the last decrease can trigger another, so
+    // that one burst of overload responses only halves the limit once.
+    absl::Time last_decrease = absl::InfinitePast();
+    HostStats stats;
+  };
+
+  HostState &GetHostLocked(std::string_view host, absl::Time now)
+      EXCLUSIVE_LOCKS_REQUIRED(mu_);
+  // Returns true and takes a slot and a token if the host admits a request,
+  // or otherwise sets *retry_in.
+  bool TryAdmitLocked(HostState *state, absl::Time now,
+                      absl::Duration *retry_in) EXCLUSIVE_LOCKS_REQUIRED(mu_);
+  void Release(const std::string &host, absl::Time admitted,
+               const Status *status);
+
+  const Options options_;
+
+  mutable absl::Mutex mu_;
+  absl::CondVar released_;
+  absl::flat_hash_map<std::string, HostState> hosts_ GUARDED_BY(mu_);
+};
+
+// Feeds transfers into a CurlMulti as their hosts' HostLimiter admits them,
+// queueing the rest. Like CurlMulti, this class is not thread-safe.
+class AdmissionQueue {
+ public:
+  // Neither is owned.
+  AdmissionQueue(CurlMulti *multi, HostLimiter *limiter);
+
+  AdmissionQueue(const AdmissionQueue &) = delete;
+  AdmissionQueue &operator=(const AdmissionQueue &) = delete;
+
+  // Queues a transfer for host. Transfers for the same host start in the
+  // order they were added. As with CurlMulti::Add, done may be null.
+  void Add(std::string host, std::unique_ptr<CURL, CurlHandleDeleter> handle,
+           CurlMulti::DoneCallback done);
+
+  // Starts every queued transfer which can be admitted now, and returns how
+  // long until another might be, to use as the timeout for CurlMulti::Poll.
+  StatusOr<absl::Duration> Pump();
+
+  // Alternates Pump and CurlMulti::Poll until no transfers remain, either
+  // queued or in flight.
+  Status Run();
+
+  std::size_t queued() const;
+
+ private:
+  struct Queued {
+    std::unique_ptr<CURL, CurlHandleDeleter> handle;
+    CurlMulti::DoneCallback done;
+  };
+
+  CurlMulti *multi_;
+  HostLimiter *limiter_;
+  absl::flat_hash_map<std::string, std::deque<Queued>> queued_;
+  std::size_t size_ = 0;
+};
+
+}  // namespace rhutil
+
+#endif  // RHUTIL_CURL_LIMITER_H_
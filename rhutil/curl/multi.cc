@@ -0,0 +1,240 @@
+#include "rhutil/curl/multi.h"
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdint>
+#include <utility>
+#include <algorithm>
+#include <vector>
+
+#include "rhutil/errno.h"
+
+namespace rhutil {
+namespace {
+
+constexpr int kMaxEventsPerPoll = 64;
+
+uint32_t CurlPollToEpollEvents(int what) {
+  uint32_t events = 0;
+  if (what == CURL_POLL_IN || what == CURL_POLL_INOUT) events |= EPOLLIN;
+  if (what == CURL_POLL_OUT || what == CURL_POLL_INOUT) events |= EPOLLOUT;
+  return events;
+}
+
+int EpollEventsToCurlSelect(uint32_t events) {
+  int mask = 0;
+  if (events & EPOLLIN) mask |= CURL_CSELECT_IN;
+  if (events & EPOLLOUT) mask |= CURL_CSELECT_OUT;
+  if (events & (EPOLLERR | EPOLLHUP)) mask |= CURL_CSELECT_ERR;
+  return mask;
+}
+
+}  // namespace
+
+CurlMulti::CurlMulti()
+  : multi_(curl_multi_init()), epoll_fd_(epoll_create1(EPOLL_CLOEXEC)),
+    wakeup_fd_(eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)),
+    timer_deadline_(absl::InfiniteFuture()) {
+  CHECK(multi_);
+  CHECK(epoll_fd_ >= 0);
+  CHECK(wakeup_fd_ >= 0);
+  epoll_event ev{};
+  ev.events = EPOLLIN;
+  ev.data.fd = wakeup_fd_;
+  CHECK(epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, wakeup_fd_, &ev) == 0);
+  CHECK_OK(CurlMultiSetopt(multi_.get(), CURLMOPT_SOCKETFUNCTION,
+                           &CurlMulti::SocketCallback));
+  CHECK_OK(CurlMultiSetopt(multi_.get(), CURLMOPT_SOCKETDATA, this));
+  CHECK_OK(CurlMultiSetopt(multi_.get(), CURLMOPT_TIMERFUNCTION,
+                           &CurlMulti::TimerCallback));
+  CHECK_OK(CurlMultiSetopt(multi_.get(), CURLMOPT_TIMERDATA, this));
+}
+
+CurlMulti::~CurlMulti() {
+  for (auto &entry : transfers_) {
+    CHECK_OK(CurlMultiCodeToStatus(
+        curl_multi_remove_handle(multi_.get(), entry.first)));
+  }
+  transfers_.clear();
+  close(wakeup_fd_);
+  close(epoll_fd_);
+}
+
+CURLM *CurlMulti::ptr() const { return multi_.get(); }
+
+Status CurlMulti::EnableMultiplexing(long max_host_connections) {
+  RETURN_IF_ERROR(CurlMultiSetopt(multi_.get(), CURLMOPT_PIPELINING,
+                                  static_cast<long>(CURLPIPE_MULTIPLEX)));
+  return CurlMultiSetopt(multi_.get(), CURLMOPT_MAX_HOST_CONNECTIONS,
+                         max_host_connections);
+}
+
+std::size_t CurlMulti::size() const { return transfers_.size(); }
+
+bool CurlMulti::empty() const { return transfers_.empty(); }
+
+Status CurlMulti::Add(std::unique_ptr<CURL, CurlHandleDeleter> handle,
+                      DoneCallback done) {
+  if (!handle) return InvalidArgumentError("handle must not be null");
+  RETURN_IF_ERROR(CurlMultiCodeToStatus(
+      curl_multi_add_handle(multi_.get(), handle.get())));
+  CURL *key = handle.get();
+  transfers_.emplace(key, Transfer{std::move(handle), std::move(done)});
+  return OkStatus();
+}
+
+StatusOr<std::unique_ptr<CURL, CurlHandleDeleter>> CurlMulti::Remove(
+    CURL *handle) {
+  auto it = transfers_.find(handle);
+  if (it == transfers_.end()) {
+    return NotFoundError("handle is not part of this CurlMulti");
+  }
+  RETURN_IF_ERROR(CurlMultiCodeToStatus(
+      curl_multi_remove_handle(multi_.get(), handle)));
+  std::unique_ptr<CURL, CurlHandleDeleter> ret = std::move(it->second.handle);
+  transfers_.erase(it);
+  return ret;
+}
+
+void CurlMulti::FailAll(const Status &status) {
+  std::vector<Transfer> failed;
+  failed.reserve(transfers_.size());
+  for (auto &[handle, transfer] : transfers_) {
+    // The transfer fails either way, so an error removing it changes nothing.
+    curl_multi_remove_handle(multi_.get(), handle);
+    failed.push_back(std::move(transfer));
+  }
+  transfers_.clear();
+  // Callbacks may add transfers, so they run only once transfers_ is settled.
+  for (Transfer &transfer : failed) {
+    if (transfer.done) transfer.done(std::move(transfer.handle), status);
+  }
+}
+
+Status CurlMulti::Poll(absl::Duration timeout) {
+  absl::Duration wait = std::min(
+      timeout, std::max(timer_deadline_ - absl::Now(), absl::ZeroDuration()));
+  int wait_ms = -1;
+  if (wait != absl::InfiniteDuration()) {
+    wait_ms = absl::ToInt64Milliseconds(
+        absl::Ceil(wait, absl::Milliseconds(1)));
+  }
+
+  epoll_event events[kMaxEventsPerPoll];
+  int nevents = epoll_wait(epoll_fd_, events, kMaxEventsPerPoll, wait_ms);
+  if (nevents < 0) {
+    if (errno != EINTR) {
+      return StatusBuilder(ErrnoAsStatus()) << "epoll_wait failed";
+    }
+    nevents = 0;
+  }
+
+  for (int i = 0; i < nevents; ++i) {
+    if (events[i].data.fd == wakeup_fd_) {
+      uint64_t count;
+      // Resets the counter. EAGAIN just means another Poll got there first.
+      if (read(wakeup_fd_, &count, sizeof(count)) == -1 && errno != EAGAIN) {
+        return StatusBuilder(ErrnoAsStatus()) << "Failed to read eventfd";
+      }
+      continue;
+    }
+    RETURN_IF_ERROR(SocketAction(events[i].data.fd,
+                                 EpollEventsToCurlSelect(events[i].events)));
+  }
+  if (absl::Now() >= timer_deadline_) {
+    timer_deadline_ = absl::InfiniteFuture();
+    RETURN_IF_ERROR(SocketAction(CURL_SOCKET_TIMEOUT, 0));
+  }
+
+  RETURN_IF_ERROR(ProcessFinished());
+  return std::exchange(callback_error_, OkStatus());
+}
+
+Status CurlMulti::Run() {
+  while (!empty()) {
+    RETURN_IF_ERROR(Poll(absl::InfiniteDuration()));
+  }
+  return OkStatus();
+}
+
+Status CurlMulti::Wakeup() {
+  const uint64_t one = 1;
+  if (write(wakeup_fd_, &one, sizeof(one)) == -1 && errno != EAGAIN) {
+    return StatusBuilder(ErrnoAsStatus()) << "Failed to write eventfd";
+  }
+  return OkStatus();
+}
+
+Status CurlMulti::SocketAction(curl_socket_t sock, int ev_bitmask) {
+  int running = 0;
+  return CurlMultiCodeToStatus(
+      curl_multi_socket_action(multi_.get(), sock, ev_bitmask, &running));
+}
+
+Status CurlMulti::ProcessFinished() {
+  int remaining = 0;
+  while (CURLMsg *msg = curl_multi_info_read(multi_.get(), &remaining)) {
+    if (msg->msg != CURLMSG_DONE) continue;
+    // msg is invalidated by curl_multi_remove_handle.
+    CURL *handle = msg->easy_handle;
+    CURLcode result = msg->data.result;
+
+    auto it = transfers_.find(handle);
+    CHECK(it != transfers_.end());
+    RETURN_IF_ERROR(CurlMultiCodeToStatus(
+        curl_multi_remove_handle(multi_.get(), handle)));
+    Transfer transfer = std::move(it->second);
+    transfers_.erase(it);
+
+    Status status = CurlEasyResultToStatus(handle, result);
+    if (transfer.done) {
+      transfer.done(std::move(transfer.handle), std::move(status));
+    }
+  }
+  return OkStatus();
+}
+
+Status CurlMulti::UpdateSocket(curl_socket_t sock, int what, bool known) {
+  if (what == CURL_POLL_REMOVE) {
+    // libcurl may already have closed the socket, which implicitly removes it
+    // from the epoll set.
+    if (epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, sock, nullptr) != 0 &&
+        errno != EBADF && errno != ENOENT) {
+      return StatusBuilder(ErrnoAsStatus()) << "epoll_ctl(DEL) failed";
+    }
+    return OkStatus();
+  }
+
+  epoll_event ev{};
+  ev.events = CurlPollToEpollEvents(what);
+  ev.data.fd = sock;
+  int op = known ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+  if (epoll_ctl(epoll_fd_, op, sock, &ev) != 0) {
+    return StatusBuilder(ErrnoAsStatus()) << "epoll_ctl failed";
+  }
+  if (known) return OkStatus();
+  return CurlMultiCodeToStatus(curl_multi_assign(multi_.get(), sock, this));
+}
+
+int CurlMulti::SocketCallback(CURL*, curl_socket_t sock, int what,
+                              void *userp, void *socketp) {
+  auto *self = reinterpret_cast<CurlMulti*>(userp);
+  Status st = self->UpdateSocket(sock, what, socketp != nullptr);
+  if (!st.ok()) self->callback_error_.Update(std::move(st));
+  return 0;
+}
+
+int CurlMulti::TimerCallback(CURLM*, long timeout_ms, void *userp) {
+  auto *self = reinterpret_cast<CurlMulti*>(userp);
+  if (timeout_ms < 0) {
+    self->timer_deadline_ = absl::InfiniteFuture();
+  } else {
+    self->timer_deadline_ = absl::Now() + absl::Milliseconds(timeout_ms);
+  }
+  return 0;
+}
+
+}  // namespace rhutil
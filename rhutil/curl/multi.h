@@ -0,0 +1,98 @@
+#ifndef RHUTIL_CURL_MULTI_H_
+#define RHUTIL_CURL_MULTI_H_
+
+#include <memory>
+#include <cstddef>
+#include <functional>
+
+#include "rhutil/status.h"
+#include "rhutil/curl/curl.h"
+#include "curl/curl.h"
+#include "absl/time/time.h"
+#include "absl/container/flat_hash_map.h"
+
+namespace rhutil {
+
+// An event loop driving many concurrent transfers on a single thread using
+// libcurl's socket callback API and epoll. Linux only.
+//
+// This class is not thread-safe. All methods (and all completion callbacks)
+// run on the thread calling Poll or Run.
+class CurlMulti {
+ public:
+  // Invoked once per transfer with the handle (ownership returned to the
+  // caller) and the same Status CurlEasyPerform would have returned.
+  using DoneCallback =
+      std::function<void(std::unique_ptr<CURL, CurlHandleDeleter>, Status)>;
+
+  CurlMulti();
+  ~CurlMulti();
+
+  // Because this class is used as the userp pointer for curl callbacks, moving
+  // a CurlMulti (which would invalidate pointers) is impossible.
+  CurlMulti(CurlMulti &&) = delete;
+  CurlMulti &operator=(CurlMulti &&) = delete;
+  CurlMulti(const CurlMulti &) = delete;
+  CurlMulti &operator=(const CurlMulti &) = delete;
+
+  CURLM *ptr() const;
+
+  // Allows transfers using HTTP/2 (see CurlEasyEnableHTTP2) to share a single
+  // connection per host. max_host_connections, if non-zero, caps the number
+  // of connections opened to any one host.
+  Status EnableMultiplexing(long max_host_connections = 0);
+
+  // The handle must have been created by CurlEasyInit. Its write callback
+  // (see CurlEasySetWriteCallback) is invoked from within Poll.
+  Status Add(std::unique_ptr<CURL, CurlHandleDeleter> handle,
+             DoneCallback done);
+
+  // Aborts an in-flight transfer without invoking its DoneCallback, and
+  // returns ownership of the handle.
+  StatusOr<std::unique_ptr<CURL, CurlHandleDeleter>> Remove(CURL *handle);
+
+  // Aborts every in-flight transfer and invokes its DoneCallback with status,
+  // e.g. once Poll has failed and the transfers cannot make progress.
+  void FailAll(const Status &status);
+
+  // Waits up to timeout for socket activity or a curl timer, performs any
+  // pending work, and invokes the DoneCallback of every finished transfer.
+  Status Poll(absl::Duration timeout);
+
+  // Calls Poll until no transfers remain.
+  Status Run();
+
+  // Makes a Poll in progress on another thread return early. Unlike every
+  // other method, this one is thread-safe.
+  Status Wakeup();
+
+  std::size_t size() const;
+  bool empty() const;
+
+ private:
+  struct Transfer {
+    std::unique_ptr<CURL, CurlHandleDeleter> handle;
+    DoneCallback done;
+  };
+
+  static int SocketCallback(CURL *handle, curl_socket_t sock, int what,
+                            void *userp, void *socketp);
+  static int TimerCallback(CURLM *multi, long timeout_ms, void *userp);
+
+  Status UpdateSocket(curl_socket_t sock, int what, bool known);
+  Status SocketAction(curl_socket_t sock, int ev_bitmask);
+  Status ProcessFinished();
+
+  std::unique_ptr<CURLM, CurlMultiDeleter> multi_;
+  int epoll_fd_;
+  // An eventfd in the epoll set, written by Wakeup.
+  int wakeup_fd_;
+  // absl::InfiniteFuture() when libcurl has no timer outstanding.
+  absl::Time timer_deadline_;
+  Status callback_error_;
+  absl::flat_hash_map<CURL*, Transfer> transfers_;
+};
+
+}  // namespace rhutil
+
+#endif  // RHUTIL_CURL_MULTI_H_
@@ -0,0 +1,107 @@
+#include "rhutil/curl/pool.h"
+
+#include <utility>
+
+#include "absl/strings/str_cat.h"
+
+namespace rhutil {
+
+using Lease = ::rhutil::CurlHandlePool::Lease;
+
+Lease::Lease() : pool_(nullptr) {}
+
+Lease::Lease(CurlHandlePool *pool, std::string key,
+             std::unique_ptr<CURL, CurlHandleDeleter> handle)
+  : pool_(pool), key_(std::move(key)), handle_(std::move(handle)) {}
+
+Lease::Lease(Lease &&o)
+  : pool_(std::exchange(o.pool_, nullptr)), key_(std::move(o.key_)),
+    handle_(std::move(o.handle_)) {}
+
+Lease &Lease::operator=(Lease &&o) {
+  if (this == &o) return *this;
+  if (pool_ != nullptr && handle_) {
+    pool_->Return(std::move(key_), std::move(handle_));
+  }
+  pool_ = std::exchange(o.pool_, nullptr);
+  key_ = std::move(o.key_);
+  handle_ = std::move(o.handle_);
+  return *this;
+}
+
+Lease::~Lease() {
+  if (pool_ == nullptr || !handle_) return;
+  pool_->Return(std::move(key_), std::move(handle_));
+}
+
+CURL *Lease::get() const { return handle_.get(); }
+
+Lease::operator bool() const { return static_cast<bool>(handle_); }
+
+std::unique_ptr<CURL, CurlHandleDeleter> Lease::Release() {
+  pool_ = nullptr;
+  return std::move(handle_);
+}
+
+CurlHandlePool::CurlHandlePool(std::size_t max_idle_per_key)
+  : max_idle_per_key_(max_idle_per_key) {}
+
+Lease CurlHandlePool::Acquire(const CurlURL &url) {
+  return Acquire(KeyFor(url));
+}
+
+Lease CurlHandlePool::Acquire(const CurlURL &url,
+                              const CurlUnixSocket &socket) {
+  return Acquire(KeyFor(url, socket));
+}
+
+Lease CurlHandlePool::Acquire(std::string_view key) {
+  std::unique_ptr<CURL, CurlHandleDeleter> handle;
+  {
+    absl::MutexLock lock(&mu_);
+    auto it = idle_.find(key);
+    if (it != idle_.end() && !it->second.empty()) {
+      handle = std::move(it->second.back());
+      it->second.pop_back();
+      --stats_.idle;
+      ++stats_.hits;
+    } else {
+      ++stats_.misses;
+    }
+  }
+  if (!handle) handle = CurlEasyInit();
+  return Lease(this, std::string(key), std::move(handle));
+}
+
+void CurlHandlePool::Return(std::string key,
+                            std::unique_ptr<CURL, CurlHandleDeleter> handle) {
+  CurlEasyReset(handle.get());
+  absl::MutexLock lock(&mu_);
+  auto &idle = idle_[key];
+  if (idle.size() >= max_idle_per_key_) {
+    // handle is destroyed after the lock is released.
+    ++stats_.evictions;
+    return;
+  }
+  idle.emplace_back(std::move(handle));
+  ++stats_.idle;
+}
+
+CurlHandlePool::Stats CurlHandlePool::GetStats() const {
+  absl::MutexLock lock(&mu_);
+  return stats_;
+}
+
+std::string CurlHandlePool::KeyFor(const CurlURL &url) {
+  auto host = url.GetHost();
+  return absl::StrCat(url.GetScheme().get(), "://", host ? host.get() : "",
+                      ":", url.GetPort());
+}
+
+std::string CurlHandlePool::KeyFor(const CurlURL &url,
+                                   const CurlUnixSocket &socket) {
+  if (socket.path.empty()) return KeyFor(url);
+  return absl::StrCat(url.GetScheme().get(), "://", socket.ToString());
+}
+
+}  // namespace rhutil
@@ -0,0 +1,100 @@
+#ifndef RHUTIL_CURL_POOL_H_
+#define RHUTIL_CURL_POOL_H_
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+#include "rhutil/curl/curl.h"
+#include "curl/curl.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/container/flat_hash_map.h"
+
+namespace rhutil {
+
+// A thread-safe pool of handles created by CurlEasyInit. Handles are recycled
+// with CurlEasyReset rather than destroyed, so that the connection cache, DNS
+// cache and TLS sessions they hold survive between requests.
+//
+// Idle handles are kept per key (usually scheme://host:port, see KeyFor) so
+// that a handle is preferentially reused for the host it is already connected
+// to.
+class CurlHandlePool {
+ public:
+  // A handle on loan from a pool. The handle is reset and returned to the pool
+  // when the lease is destroyed.
+  class Lease {
+   public:
+    Lease();
+    ~Lease();
+
+    Lease(Lease &&);
+    Lease &operator=(Lease &&);
+    Lease(const Lease &) = delete;
+    Lease &operator=(const Lease &) = delete;
+
+    CURL *get() const;
+    explicit operator bool() const;
+
+    // Takes the handle out of the pool's control. It will not be returned.
+    std::unique_ptr<CURL, CurlHandleDeleter> Release();
+
+   private:
+    friend class CurlHandlePool;
+    Lease(CurlHandlePool *pool, std::string key,
+          std::unique_ptr<CURL, CurlHandleDeleter> handle);
+
+    CurlHandlePool *pool_;
+    std::string key_;
+    std::unique_ptr<CURL, CurlHandleDeleter> handle_;
+  };
+
+  struct Stats {
+    // Acquisitions served by an idle handle for the same key.
+    uint64_t hits = 0;
+    // Acquisitions which required a new handle.
+    uint64_t misses = 0;
+    // Handles destroyed on return because their key's idle list was full.
+    uint64_t evictions = 0;
+    std::size_t idle = 0;
+  };
+
+  explicit CurlHandlePool(std::size_t max_idle_per_key = 8);
+
+  // All leases must be returned before the pool is destroyed.
+  ~CurlHandlePool() = default;
+
+  CurlHandlePool(const CurlHandlePool &) = delete;
+  CurlHandlePool &operator=(const CurlHandlePool &) = delete;
+
+  Lease Acquire(std::string_view key);
+  Lease Acquire(const CurlURL &url);
+  // For transfers to url over a Unix domain socket.
+  Lease Acquire(const CurlURL &url, const CurlUnixSocket &socket);
+
+  Stats GetStats() const;
+
+  // Returns scheme://host:port for url.
+  static std::string KeyFor(const CurlURL &url);
+  // Returns scheme://unix:path (or unix-abstract:path), since the socket,
+  // not the URL's host, determines the connection.
+  static std::string KeyFor(const CurlURL &url, const CurlUnixSocket &socket);
+
+ private:
+  void Return(std::string key, std::unique_ptr<CURL, CurlHandleDeleter> handle);
+
+  const std::size_t max_idle_per_key_;
+
+  mutable absl::Mutex mu_;
+  absl::flat_hash_map<std::string,
+                      std::vector<std::unique_ptr<CURL, CurlHandleDeleter>>>
+      idle_ GUARDED_BY(mu_);
+  Stats stats_ GUARDED_BY(mu_);
+};
+
+}  // namespace rhutil
+
+#endif  // RHUTIL_CURL_POOL_H_
@@ -0,0 +1,263 @@
+#include "rhutil/curl/range.h"
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "rhutil/errno.h"
+#include "rhutil/curl/multi.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
+
+namespace rhutil {
+namespace {
+
+constexpr int64_t kUnknownEnd = -1;
+
+struct Range {
+  // The next byte to fetch.
+  int64_t next = 0;
+  // Exclusive, or kUnknownEnd to read until the server stops.
+  int64_t end = kUnknownEnd;
+  int attempts = 0;
+};
+
+// Writes a range's body at its offset, but only once the response has turned
+// out to be the one asked for: 206 for a range request, and any 2xx
+// otherwise. Other bodies (error pages, or a whole object sent by a server
+// which ignored the range) are discarded, leaving the range to be retried.
+template <typename WriteAt>
+class RangeSink {
+ public:
+  RangeSink(Range *range, bool ranged, const WriteAt *write_at)
+    : range_(range), ranged_(ranged), write_at_(write_at) {}
+
+  // Called before each attempt.
+  void Start(CURL *handle) {
+    handle_ = handle;
+    checked_ = false;
+    accepted_ = false;
+  }
+
+  bool Write(std::string_view chunk, size_t*, Status *error) {
+    if (!checked_) {
+      checked_ = true;
+      long response_code = 0;
+      Status st = CurlEasyGetInfo(handle_, CURLINFO_RESPONSE_CODE,
+                                  &response_code);
+      if (!st.ok()) {
+        *error = std::move(st);
+        return false;
+      }
+      accepted_ = ranged_ ? response_code == 206
+                          : response_code >= 200 && response_code < 300;
+    }
+    if (!accepted_) return true;
+    if (range_->end != kUnknownEnd &&
+        static_cast<int64_t>(chunk.size()) > range_->end - range_->next) {
+      *error = OutOfRangeError("Server sent more than the requested range");
+      return false;
+    }
+    Status st = (*write_at_)(range_->next, chunk);
+    if (!st.ok()) {
+      *error = std::move(st);
+      return false;
+    }
+    range_->next += chunk.size();
+    return true;
+  }
+
+ private:
+  Range *range_;
+  const bool ranged_;
+  const WriteAt *write_at_;
+  CURL *handle_ = nullptr;
+  bool checked_ = false;
+  bool accepted_ = false;
+};
+
+// Discards the body of a probe, and aborts it if the server ignored the range
+// and is sending the whole object.
+class ProbeSink {
+ public:
+  bool Write(std::string_view chunk, size_t*, Status *error) {
+    received_ += chunk.size();
+    if (received_ > 1) {
+      *error = CancelledError("Server ignored the probe's range");
+      return false;
+    }
+    return true;
+  }
+
+ private:
+  std::size_t received_ = 0;
+};
+
+}  // namespace
+
+RangedDownloader::RangedDownloader() : RangedDownloader(Options()) {}
+
+RangedDownloader::RangedDownloader(Options options)
+  : options_(std::move(options)) {}
+
+Status RangedDownloader::Configure(CURL *handle,
+                                   const std::string &url) const {
+  RETURN_IF_ERROR(CurlEasySetopt(handle, CURLOPT_URL, url.c_str()));
+  if (options_.configure) RETURN_IF_ERROR(options_.configure(handle));
+  return OkStatus();
+}
+
+StatusOr<RangedDownloader::ObjectInfo> RangedDownloader::Probe(
+    const std::string &url) const {
+  auto handle = CurlEasyInit();
+  RETURN_IF_ERROR(Configure(handle.get(), url));
+  RETURN_IF_ERROR(CurlEasySetopt(handle.get(), CURLOPT_RANGE, "0-0"));
+  RETURN_IF_ERROR(CurlEasyCaptureHeaders(handle.get()));
+  ProbeSink sink;
+  RETURN_IF_ERROR(CurlEasySetWriteSink(handle.get(), &sink));
+
+  Status status = CurlEasyPerform(handle.get());
+  long response_code = 0;
+  RETURN_IF_ERROR(CurlEasyGetInfo(handle.get(), CURLINFO_RESPONSE_CODE,
+                                  &response_code));
+  const std::string_view content_range = CurlEasyGetResponseHeaders(
+      handle.get())->Get("Content-Range").value_or("");
+  ObjectInfo info;
+  if (response_code == 206 || response_code == 416) {
+    // "bytes 0-0/1234", or "bytes */0" for an empty object.
+    auto slash = content_range.rfind('/');
+    if (slash != std::string::npos &&
+        absl::SimpleAtoi(content_range.substr(slash + 1), &info.size)) {
+      info.accepts_ranges = true;
+      return info;
+    }
+    RETURN_IF_ERROR(status);
+    return StatusBuilder(DataLossError("Bad Content-Range "))
+        << "'" << content_range << "' from " << url;
+  } else if (response_code == 200) {
+    curl_off_t length = -1;
+    RETURN_IF_ERROR(CurlEasyGetInfo(
+        handle.get(), CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &length));
+    info.size = length;
+    return info;
+  }
+  RETURN_IF_ERROR(status);
+  return FailedPreconditionErrorBuilder()
+      << "Unexpected HTTP code " << response_code << " probing " << url;
+}
+
+Status RangedDownloader::DownloadToFile(const std::string &url,
+                                        int fd) const {
+  ASSIGN_OR_RETURN(ObjectInfo info, Probe(url));
+  if (ftruncate(fd, std::max<int64_t>(info.size, 0)) == -1) {
+    return StatusBuilder(ErrnoAsStatus()) << "Failed to resize file";
+  }
+  return Download(url, info, [fd](int64_t offset, std::string_view data) {
+    while (!data.empty()) {
+      ssize_t n = pwrite(fd, data.data(), data.size(), offset);
+      if (n == -1) {
+        if (errno == EINTR) continue;
+        return ErrnoAsStatus();
+      }
+      data.remove_prefix(n);
+      offset += n;
+    }
+    return OkStatus();
+  });
+}
+
+Status RangedDownloader::DownloadToString(const std::string &url,
+                                          std::string *out) const {
+  ASSIGN_OR_RETURN(ObjectInfo info, Probe(url));
+  out->clear();
+  out->resize(std::max<int64_t>(info.size, 0));
+  return Download(url, info, [out](int64_t offset, std::string_view data) {
+    // Only downloads of unknown size grow the buffer.
+    if (offset + data.size() > out->size()) out->resize(offset + data.size());
+    std::memcpy(&(*out)[offset], data.data(), data.size());
+    return OkStatus();
+  });
+}
+
+Status RangedDownloader::Download(const std::string &url,
+                                  const ObjectInfo &info,
+                                  const WriteAt &write_at) const {
+  const bool ranged = info.accepts_ranges && info.size >= 0;
+  std::vector<Range> ranges;
+  if (ranged) {
+    const int64_t connections = std::max(options_.connections, 1);
+    const int64_t range_size = std::max<int64_t>(
+        std::max<int64_t>(options_.min_range_size, 1),
+        (info.size + connections - 1) / connections);
+    for (int64_t begin = 0; begin < info.size; begin += range_size) {
+      ranges.push_back({begin, std::min(info.size, begin + range_size)});
+    }
+  } else {
+    ranges.push_back({0, kUnknownEnd});
+  }
+  std::vector<RangeSink<WriteAt>> sinks;
+  sinks.reserve(ranges.size());
+  for (Range &range : ranges) sinks.emplace_back(&range, ranged, &write_at);
+
+  CurlMulti multi;
+  Status error;
+  // Starts (or restarts) fetching a range, reusing handle and its connection.
+  std::function<Status(std::unique_ptr<CURL, CurlHandleDeleter>, std::size_t)>
+      start = [&](std::unique_ptr<CURL, CurlHandleDeleter> handle,
+                  std::size_t index) -> Status {
+    const Range &range = ranges[index];
+    if (ranged) {
+      RETURN_IF_ERROR(CurlEasySetopt(
+          handle.get(), CURLOPT_RANGE,
+          absl::StrCat(range.next, "-", range.end - 1).c_str()));
+    }
+    sinks[index].Start(handle.get());
+    RETURN_IF_ERROR(CurlEasySetWriteSink(handle.get(), &sinks[index]));
+    return multi.Add(std::move(handle), [&, index](
+        std::unique_ptr<CURL, CurlHandleDeleter> handle, Status status) {
+      Range &range = ranges[index];
+      long response_code = 0;
+      status.Update(CurlEasyGetInfo(handle.get(), CURLINFO_RESPONSE_CODE,
+                                    &response_code));
+      if (status.ok() && ranged && response_code != 206) {
+        error.Update(FailedPreconditionErrorBuilder()
+                     << "Server answered a range request for " << url
+                     << " with HTTP code " << response_code);
+        return;
+      }
+      if (status.ok() && range.end != kUnknownEnd && range.next != range.end) {
+        status = DataLossError("Transfer ended before the range was complete");
+      }
+      if (!status.ok()) {
+        if (++range.attempts < options_.max_attempts) {
+          // Ranged requests resume where they left off, but without ranges
+          // the whole object has to be fetched again.
+          if (!ranged) range.next = 0;
+          error.Update(start(std::move(handle), index));
+          return;
+        }
+        error.Update(StatusBuilder(std::move(status))
+                     << "; fetching " << url << " from byte " << range.next);
+      }
+    });
+  };
+
+  // There are never more ranges than connections, so each gets its own.
+  for (std::size_t i = 0; i < ranges.size(); ++i) {
+    auto handle = CurlEasyInit();
+    RETURN_IF_ERROR(Configure(handle.get(), url));
+    RETURN_IF_ERROR(start(std::move(handle), i));
+  }
+  // Returning early cancels any transfers still in flight.
+  while (!multi.empty() && error.ok()) {
+    RETURN_IF_ERROR(multi.Poll(absl::InfiniteDuration()));
+  }
+  return error;
+}
+
+}  // namespace rhutil
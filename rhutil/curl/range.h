@@ -0,0 +1,65 @@
+#ifndef RHUTIL_CURL_RANGE_H_
+#define RHUTIL_CURL_RANGE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <string_view>
+
+#include "rhutil/status.h"
+#include "rhutil/curl/curl.h"
+
+namespace rhutil {
+
+// Downloads large objects as several byte ranges fetched concurrently over
+// separate connections, writing each range straight to its offset in the
+// destination. A range which fails is retried on its own, resuming from the
+// last byte received. Servers which do not support range requests get a
+// single ordinary download instead.
+class RangedDownloader {
+ public:
+  struct Options {
+    // The number of ranges (and connections) to split an object into.
+    int connections = 8;
+    // Objects are not split into ranges smaller than this.
+    int64_t min_range_size = 4 << 20;
+    // Per range, including the first attempt.
+    int max_attempts = 3;
+    // If set, called on every handle before its transfer starts, e.g. to
+    // set headers, timeouts or a share. It must not set a write callback.
+    std::function<Status(CURL*)> configure;
+  };
+
+  struct ObjectInfo {
+    // -1 if the server did not say.
+    int64_t size = -1;
+    bool accepts_ranges = false;
+  };
+
+  RangedDownloader();
+  explicit RangedDownloader(Options options);
+
+  // Finds the size of the object at url with a request for its first byte.
+  StatusOr<ObjectInfo> Probe(const std::string &url) const;
+
+  // Downloads url into fd, which must be open for writing and is truncated to
+  // the object's size.
+  Status DownloadToFile(const std::string &url, int fd) const;
+  // Downloads url into *out, which is resized to the object's size.
+  Status DownloadToString(const std::string &url, std::string *out) const;
+
+ private:
+  // Writes data at offset in the destination.
+  using WriteAt = std::function<Status(int64_t offset, std::string_view data)>;
+
+  Status Download(const std::string &url, const ObjectInfo &info,
+                  const WriteAt &write_at) const;
+  Status Configure(CURL *handle, const std::string &url) const;
+
+  const Options options_;
+};
+
+}  // namespace rhutil
+
+#endif  // RHUTIL_CURL_RANGE_H_
@@ -0,0 +1,118 @@
+#include "rhutil/curl/retry.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "absl/random/random.h"
+#include "absl/time/clock.h"
+
+namespace rhutil {
+namespace {
+
+absl::Duration JitteredBackoff(const RetryPolicy &policy, int attempt) {
+  static thread_local absl::BitGen gen;
+  absl::Duration ceiling = std::min(
+      policy.max_backoff,
+      policy.initial_backoff *
+          std::pow(policy.backoff_multiplier, attempt - 1));
+  if (ceiling <= absl::ZeroDuration()) return absl::ZeroDuration();
+  return absl::Nanoseconds(
+      absl::Uniform<int64_t>(gen, 0, absl::ToInt64Nanoseconds(ceiling)));
+}
+
+Status RetryIf(
+    const RetryPolicy &policy,
+    const std::function<Status(absl::Duration *retry_after)> &attempt,
+    const std::function<bool(const Status&)> &retryable) {
+  if (policy.budget != nullptr) policy.budget->RecordRequest();
+  for (int n = 1;; ++n) {
+    absl::Duration retry_after;
+    Status status = attempt(&retry_after);
+    if (status.ok() || !retryable(status) || n >= policy.max_attempts) {
+      return status;
+    }
+    if (retry_after > policy.max_retry_after) {
+      return StatusBuilder(status)
+          << "; not retrying, server asked to wait "
+          << absl::FormatDuration(retry_after);
+    }
+    const absl::Duration delay =
+        std::max(JitteredBackoff(policy, n), retry_after);
+    if (absl::Now() + delay >= policy.deadline) {
+      return StatusBuilder(status)
+          << "; not retrying, the deadline would pass first";
+    }
+    if (policy.budget != nullptr && !policy.budget->TryWithdraw()) {
+      return StatusBuilder(status) << "; retry budget exhausted";
+    }
+    absl::SleepFor(delay);
+  }
+}
+
+}  // namespace
+
+RetryBudget::RetryBudget(double retry_ratio, double max_tokens)
+  : retry_ratio_(retry_ratio), max_tokens_(max_tokens), tokens_(max_tokens) {}
+
+void RetryBudget::RecordRequest() {
+  absl::MutexLock lock(&mu_);
+  tokens_ = std::min(max_tokens_, tokens_ + retry_ratio_);
+}
+
+bool RetryBudget::TryWithdraw() {
+  absl::MutexLock lock(&mu_);
+  if (tokens_ < 1) return false;
+  tokens_ -= 1;
+  return true;
+}
+
+bool IsRetryable(const Status &status) {
+  switch (status.code()) {
+    case StatusCode::kResourceExhausted:
+    case StatusCode::kUnavailable:
+      return true;
+    default:
+      return false;
+  }
+}
+
+bool IsRetryableHTTPCode(long response_code) {
+  switch (response_code) {
+    case 429:
+    case 503:
+    case 504:
+      return true;
+    default:
+      return false;
+  }
+}
+
+Status Retry(
+    const RetryPolicy &policy,
+    const std::function<Status(absl::Duration *retry_after)> &attempt) {
+  return RetryIf(policy, attempt, IsRetryable);
+}
+
+Status CurlEasyPerformWithRetry(CURL *handle, const RetryPolicy &policy,
+                                const std::function<Status()> &before_attempt) {
+  long response_code = 0;
+  auto attempt = [&](absl::Duration *retry_after) -> Status {
+    response_code = 0;
+    if (before_attempt) RETURN_IF_ERROR(before_attempt());
+    Status status = CurlEasyPerform(handle);
+    RETURN_IF_ERROR(CurlEasyGetInfo(handle, CURLINFO_RESPONSE_CODE,
+                                    &response_code));
+    curl_off_t retry_after_secs = 0;
+    RETURN_IF_ERROR(CurlEasyGetInfo(handle, CURLINFO_RETRY_AFTER,
+                                    &retry_after_secs));
+    *retry_after = absl::Seconds(retry_after_secs);
+    return status;
+  };
+  // The response code tells a 504 apart from the transfer's own deadline,
+  // which both fail with DeadlineExceeded.
+  return RetryIf(policy, attempt, [&response_code](const Status &status) {
+    return IsRetryable(status) || IsRetryableHTTPCode(response_code);
+  });
+}
+
+}  // namespace rhutil
@@ -0,0 +1,78 @@
+#ifndef RHUTIL_CURL_RETRY_H_
+#define RHUTIL_CURL_RETRY_H_
+
+#include <functional>
+
+#include "rhutil/status.h"
+#include "rhutil/curl/curl.h"
+#include "absl/time/time.h"
+#include "absl/synchronization/mutex.h"
+
+namespace rhutil {
+
+// Limits retries to a fraction of overall traffic, so that retries cannot
+// multiply load on a backend which is already failing. Every first attempt
+// deposits retry_ratio tokens (up to max_tokens), and every retry withdraws
+// one. Thread-safe.
+class RetryBudget {
+ public:
+  explicit RetryBudget(double retry_ratio = 0.1, double max_tokens = 10);
+
+  RetryBudget(const RetryBudget &) = delete;
+  RetryBudget &operator=(const RetryBudget &) = delete;
+
+  void RecordRequest();
+  // Returns false if the budget is exhausted.
+  bool TryWithdraw();
+
+ private:
+  const double retry_ratio_;
+  const double max_tokens_;
+  absl::Mutex mu_;
+  double tokens_ GUARDED_BY(mu_);
+};
+
+struct RetryPolicy {
+  // Including the first attempt.
+  int max_attempts = 3;
+  // Attempt n (counting from 1) sleeps for a uniformly random duration in
+  // [0, min(max_backoff, initial_backoff * multiplier^(n-1))).
+  absl::Duration initial_backoff = absl::Milliseconds(100);
+  absl::Duration max_backoff = absl::Seconds(10);
+  double backoff_multiplier = 2;
+  // A server-provided Retry-After longer than this stops retrying instead.
+  absl::Duration max_retry_after = absl::Seconds(30);
+  // Retrying stops rather than sleep past this, typically the deadline of the
+  // CurlContext which each attempt uses.
+  absl::Time deadline = absl::InfiniteFuture();
+  // Optional and not owned.
+  RetryBudget *budget = nullptr;
+};
+
+// Whether a Status (e.g. from HTTPCodeToStatus) signals a transient failure:
+// ResourceExhausted (429) or Unavailable (503). DeadlineExceeded is not, as it
+// usually means the caller's own deadline or timeout has passed, which
+// another attempt cannot fix; HTTP 504 is retried by its response code.
+bool IsRetryable(const Status &status);
+
+// Whether an HTTP response code signals a transient failure: 429, 503 or 504.
+bool IsRetryableHTTPCode(long response_code);
+
+// Calls attempt until it succeeds, fails with a status which is not
+// retryable, or the policy or budget gives up. attempt may set *retry_after
+// to a server-requested delay, which is honoured if longer than the backoff.
+Status Retry(const RetryPolicy &policy,
+             const std::function<Status(absl::Duration *retry_after)> &attempt);
+
+// Retry for a handle created by CurlEasyInit, honouring the Retry-After
+// response header. Attempts are retried if IsRetryable or if the response
+// code is, so a 504 is retried but a transfer which hit its own deadline or
+// timeout is not. The request must be idempotent. before_attempt, if set, is
+// called before every attempt, typically to reset the write sink.
+Status CurlEasyPerformWithRetry(
+    CURL *handle, const RetryPolicy &policy,
+    const std::function<Status()> &before_attempt = nullptr);
+
+}  // namespace rhutil
+
+#endif  // RHUTIL_CURL_RETRY_H_
@@ -0,0 +1,169 @@
+#include "rhutil/curl/singleflight.h"
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+#include "rhutil/cleanup.h"
+#include "rhutil/curl/sinks.h"
+#include "absl/strings/ascii.h"
+#include "absl/strings/str_cat.h"
+#include "absl/time/clock.h"
+
+namespace rhutil {
+namespace {
+
+// How often a waiter whose context can be cancelled checks for it.
+constexpr absl::Duration kCancellationPoll = absl::Milliseconds(50);
+
+// The normalized URL, then the normalized headers in sorted order.
+StatusOr<std::string> FlightKey(
+    const CurlURL &url, absl::Span<const std::string_view> request_headers) {
+  CurlURL normalized(url);
+  ASSIGN_OR_RETURN(auto scheme, normalized.Get(CURLUPART_SCHEME));
+  ASSIGN_OR_RETURN(auto host, normalized.Get(CURLUPART_HOST));
+  RETURN_IF_ERROR(normalized.Set(CURLUPART_SCHEME,
+                                 absl::AsciiStrToLower(scheme.get())));
+  RETURN_IF_ERROR(normalized.Set(CURLUPART_HOST,
+                                 absl::AsciiStrToLower(host.get())));
+  RETURN_IF_ERROR(CurlURL::CodeToStatus(curl_url_set(
+      normalized.GetCURLU(), CURLUPART_FRAGMENT, nullptr, 0)));
+  ASSIGN_OR_RETURN(auto key,
+                   normalized.Get(CURLUPART_URL, CURLU_NO_DEFAULT_PORT));
+
+  std::vector<std::string> headers;
+  headers.reserve(request_headers.size());
+  for (std::string_view line : request_headers) {
+    auto colon = std::min(line.find(':'), line.size());
+    std::string_view name = absl::StripAsciiWhitespace(line.substr(0, colon));
+    headers.push_back(
+        absl::StrCat(absl::AsciiStrToLower(name), ":",
+                     absl::StripAsciiWhitespace(line.substr(colon + 1))));
+  }
+  std::sort(headers.begin(), headers.end());
+  std::string ret(key.get());
+  for (const std::string &header : headers) absl::StrAppend(&ret, "\n", header);
+  return ret;
+}
+
+}  // namespace
+
+StatusOr<SingleFlight::Response> SingleFlight::Fetch(
+    CURL *handle, const CurlURL &url,
+    absl::Span<const std::string_view> request_headers) {
+  ASSIGN_OR_RETURN(std::string key, FlightKey(url, request_headers));
+  ASSIGN_OR_RETURN(auto url_str, url.Get(CURLUPART_URL));
+  const std::optional<CurlContext> context = CurlEasyGetContext(handle);
+  for (bool waited = false;; waited = true) {
+    std::shared_ptr<Flight> flight;
+    bool leader = false;
+    {
+      absl::MutexLock lock(&mu_);
+      std::shared_ptr<Flight> &slot = flights_[key];
+      if (slot == nullptr) {
+        slot = std::make_shared<Flight>();
+        leader = true;
+        ++stats_.transfers;
+        if (waited) ++stats_.takeovers;
+      } else if (!waited) {
+        ++stats_.coalesced;
+      }
+      flight = slot;
+    }
+
+    if (!leader) {
+      RETURN_IF_ERROR(Wait(*flight, context));
+      if (flight->abandoned) continue;
+      if (!flight->result.ok()) return flight->result.status();
+      Response response = flight->result.ValueOrDie();
+      response.shared = true;
+      return response;
+    }
+
+    long response_code = 0;
+    flight->result =
+        Perform(handle, url_str.get(), request_headers, &response_code);
+    // Cancellation and deadlines (other than a 504's) belong to this request
+    // alone, and say nothing of how the transfer would go for the waiters.
+    const StatusCode code = flight->result.status().code();
+    flight->abandoned = code == StatusCode::kCancelled ||
+                        (code == StatusCode::kDeadlineExceeded &&
+                         response_code != 504);
+    {
+      absl::MutexLock lock(&mu_);
+      flights_.erase(key);
+    }
+    flight->done.Notify();
+    return flight->result;
+  }
+}
+
+Status SingleFlight::Wait(const Flight &flight,
+                          const std::optional<CurlContext> &context) {
+  if (!context.has_value()) {
+    flight.done.WaitForNotification();
+    return OkStatus();
+  }
+  // Cancellation cannot wake the wait, so it is polled.
+  const absl::Duration poll = context->cancellation == nullptr
+      ? absl::InfiniteDuration() : kCancellationPoll;
+  while (!flight.done.WaitForNotificationWithDeadline(
+             std::min(context->deadline, absl::Now() + poll))) {
+    if (context->cancellation != nullptr &&
+        context->cancellation->cancelled()) {
+      return CancelledError("Cancelled waiting for an identical request");
+    }
+    if (absl::Now() >= context->deadline) {
+      return DeadlineExceededError(
+          "Deadline exceeded waiting for an identical request");
+    }
+  }
+  return OkStatus();
+}
+
+StatusOr<SingleFlight::Response> SingleFlight::Perform(
+    CURL *handle, const char *url,
+    absl::Span<const std::string_view> request_headers,
+    long *response_code) {
+  std::unique_ptr<curl_slist, CurlSListDeleter> header_list;
+  // curl_slist_append copies each header, so one buffer serves them all.
+  std::string line;
+  for (std::string_view header : request_headers) {
+    line.assign(header.data(), header.size());
+    curl_slist *appended = curl_slist_append(header_list.get(), line.c_str());
+    if (appended == nullptr) return InternalError("curl_slist_append failed");
+    header_list.release();
+    header_list.reset(appended);
+  }
+
+  std::string body;
+  StringSink sink(&body);
+  Cleanup unset([handle] {
+    CurlEasySetopt(handle, CURLOPT_HTTPHEADER,
+                   static_cast<curl_slist*>(nullptr)).IgnoreError();
+    CurlEasySetWriteCallback(handle, nullptr).IgnoreError();
+  });
+  RETURN_IF_ERROR(CurlEasySetopt(handle, CURLOPT_HTTPGET, 1L));
+  RETURN_IF_ERROR(CurlEasySetopt(handle, CURLOPT_URL, url));
+  RETURN_IF_ERROR(
+      CurlEasySetopt(handle, CURLOPT_HTTPHEADER, header_list.get()));
+  RETURN_IF_ERROR(CurlEasySetWriteSink(handle, &sink));
+  Status status = CurlEasyPerform(handle);
+  RETURN_IF_ERROR(CurlEasyGetInfo(handle, CURLINFO_RESPONSE_CODE,
+                                  response_code));
+  RETURN_IF_ERROR(status);
+
+  Response response;
+  response.response_code = *response_code;
+  response.body = std::make_shared<const std::string>(std::move(body));
+  return response;
+}
+
+SingleFlight::Stats SingleFlight::GetStats() const {
+  absl::MutexLock lock(&mu_);
+  Stats stats = stats_;
+  stats.in_flight = flights_.size();
+  return stats;
+}
+
+}  // namespace rhutil
@@ -0,0 +1,97 @@
+#ifndef RHUTIL_CURL_SINGLEFLIGHT_H_
+#define RHUTIL_CURL_SINGLEFLIGHT_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+
+#include "rhutil/status.h"
+#include "rhutil/curl/curl.h"
+#include "absl/types/span.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/synchronization/notification.h"
+#include "absl/container/flat_hash_map.h"
+
+namespace rhutil {
+
+// Coalesces identical concurrent GETs: while one is in flight, further
+// requests for the same URL and headers wait for its response instead of
+// starting their own. Nothing is kept once a transfer finishes; see HttpCache
+// for that. Thread-safe.
+class SingleFlight {
+ public:
+  struct Response {
+    long response_code = 0;
+    // Shared by every request the transfer served.
+    std::shared_ptr<const std::string> body;
+    // Whether this request waited for another's transfer rather than making
+    // its own.
+    bool shared = false;
+  };
+
+  struct Stats {
+    uint64_t transfers = 0;
+    uint64_t coalesced = 0;
+    // Waiting requests which made the transfer themselves after the request
+    // making it gave up. Also counted in transfers.
+    uint64_t takeovers = 0;
+    std::size_t in_flight = 0;
+  };
+
+  SingleFlight() = default;
+
+  SingleFlight(const SingleFlight &) = delete;
+  SingleFlight &operator=(const SingleFlight &) = delete;
+
+  // GETs url using handle, or waits for an identical request already in
+  // flight. Requests are identical if their URLs match once normalized
+  // (lowercase scheme and host, no default port or fragment), and so do
+  // request_headers, which are "Name: value" lines compared regardless of
+  // order and of the case of names.
+  //
+  // Waiters get the same outcome as the request which made the transfer,
+  // including errors due to its handle's options, so handles used for the
+  // same URL should be configured alike. The exception is the CurlContext:
+  // a waiter stops waiting when its own handle's context is cancelled or
+  // its deadline passes, and if the transfer fails because the context of
+  // the request making it ended, a waiter makes the transfer instead.
+  //
+  // Fetch sets the URL of handle and clears its HTTP headers and write
+  // callback, so those must be set again before it is used for anything
+  // else.
+  StatusOr<Response> Fetch(
+      CURL *handle, const CurlURL &url,
+      absl::Span<const std::string_view> request_headers = {});
+
+  Stats GetStats() const;
+
+ private:
+  struct Flight {
+    absl::Notification done;
+    // Set before done is notified.
+    StatusOr<Response> result;
+    // Whether result is the leader giving up, rather than the outcome of the
+    // request, so that a waiter should make the transfer instead.
+    bool abandoned = false;
+  };
+
+  // Waits for flight to finish, or fails once context ends.
+  static Status Wait(const Flight &flight,
+                     const std::optional<CurlContext> &context);
+  static StatusOr<Response> Perform(
+      CURL *handle, const char *url,
+      absl::Span<const std::string_view> request_headers,
+      long *response_code);
+
+  mutable absl::Mutex mu_;
+  absl::flat_hash_map<std::string, std::shared_ptr<Flight>> flights_
+      GUARDED_BY(mu_);
+  Stats stats_ GUARDED_BY(mu_);
+};
+
+}  // namespace rhutil
+
+#endif  // RHUTIL_CURL_SINGLEFLIGHT_H_
@@ -0,0 +1,108 @@
+#include "rhutil/curl/sinks.h"
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#include "rhutil/errno.h"
+#include "curl/curl.h"
+
+namespace rhutil {
+
+BufferSink::BufferSink(absl::Span<char> buffer) : buffer_(buffer) {}
+
+bool BufferSink::Write(std::string_view chunk, size_t*, Status *error) {
+  if (chunk.size() > buffer_.size() - size_) {
+    *error = StatusBuilder(ResourceExhaustedError("Response body too large"))
+        << " for a buffer of " << buffer_.size() << " bytes";
+    return false;
+  }
+  std::memcpy(buffer_.data() + size_, chunk.data(), chunk.size());
+  size_ += chunk.size();
+  return true;
+}
+
+std::string_view BufferSink::data() const { return {buffer_.data(), size_}; }
+
+void BufferSink::Clear() { size_ = 0; }
+
+StringSink::StringSink(std::string *out) : out_(out) {}
+
+bool StringSink::Write(std::string_view chunk, size_t*, Status*) {
+  out_->append(chunk.data(), chunk.size());
+  return true;
+}
+
+RingBufferSink::RingBufferSink(std::size_t capacity)
+  : buffer_(new char[capacity]), capacity_(capacity) {
+  CHECK(capacity_ > 0);
+}
+
+bool RingBufferSink::Write(std::string_view chunk, size_t *flags,
+                           Status *error) {
+  if (chunk.size() > capacity_) {
+    *error = StatusBuilder(ResourceExhaustedError("Chunk of "))
+        << chunk.size() << " bytes can never fit in a ring buffer of "
+        << capacity_ << " bytes";
+    return false;
+  }
+  if (chunk.size() > capacity_ - size_) {
+    paused_ = true;
+    *flags = CURL_WRITEFUNC_PAUSE;
+    return true;
+  }
+  paused_ = false;
+  // libcurl delivers empty chunks, e.g. for an empty body.
+  if (chunk.empty()) return true;
+
+  std::size_t tail = (head_ + size_) % capacity_;
+  std::size_t first = std::min(chunk.size(), capacity_ - tail);
+  std::memcpy(buffer_.get() + tail, chunk.data(), first);
+  std::memcpy(buffer_.get(), chunk.data() + first, chunk.size() - first);
+  size_ += chunk.size();
+  return true;
+}
+
+std::string_view RingBufferSink::Peek() const {
+  return {buffer_.get() + head_, std::min(size_, capacity_ - head_)};
+}
+
+void RingBufferSink::Consume(std::size_t n) {
+  CHECK(n <= size_);
+  if (n == 0) return;
+  head_ = (head_ + n) % capacity_;
+  size_ -= n;
+  if (size_ == 0) head_ = 0;
+}
+
+std::size_t RingBufferSink::size() const { return size_; }
+
+std::size_t RingBufferSink::capacity() const { return capacity_; }
+
+bool RingBufferSink::paused() const { return paused_; }
+
+FileDescriptorSink::FileDescriptorSink(int fd) : fd_(fd) {}
+
+bool FileDescriptorSink::Write(std::string_view chunk, size_t*,
+                               Status *error) {
+  while (!chunk.empty()) {
+    ssize_t n = write(fd_, chunk.data(), chunk.size());
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      *error = StatusBuilder(ErrnoAsStatus()) << "Failed to write to fd "
+                                               << fd_;
+      return false;
+    }
+    chunk.remove_prefix(n);
+    bytes_written_ += n;
+  }
+  return true;
+}
+
+std::size_t FileDescriptorSink::bytes_written() const {
+  return bytes_written_;
+}
+
+}  // namespace rhutil
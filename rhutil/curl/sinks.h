@@ -0,0 +1,152 @@
+#ifndef RHUTIL_CURL_SINKS_H_
+#define RHUTIL_CURL_SINKS_H_
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+
+#include "rhutil/status.h"
+#include "rhutil/curl/curl.h"
+#include "curl/curl.h"
+#include "absl/types/span.h"
+
+namespace rhutil {
+
+// Write sinks for use with CurlEasySetWriteSink. None of these are
+// thread-safe.
+
+// Appends into a caller-provided buffer. Fails the transfer with
+// ResourceExhausted if the body does not fit.
+class BufferSink {
+ public:
+  explicit BufferSink(absl::Span<char> buffer);
+
+  bool Write(std::string_view chunk, size_t *flags, Status *error);
+
+  std::string_view data() const;
+  void Clear();
+
+ private:
+  absl::Span<char> buffer_;
+  std::size_t size_ = 0;
+};
+
+// Appends into a std::string, which callers may reserve ahead of time.
+class StringSink {
+ public:
+  explicit StringSink(std::string *out);
+
+  bool Write(std::string_view chunk, size_t *flags, Status *error);
+
+ private:
+  std::string *out_;
+};
+
+// A fixed-capacity ring buffer. When a chunk does not fit the transfer is
+// paused (CURL_WRITEFUNC_PAUSE) and libcurl redelivers the same chunk once the
+// consumer has made room and unpaused the handle with curl_easy_pause.
+class RingBufferSink {
+ public:
+  // capacity must be positive.
+  explicit RingBufferSink(std::size_t capacity);
+
+  bool Write(std::string_view chunk, size_t *flags, Status *error);
+
+  // Returns the longest contiguous readable region. It remains valid until the
+  // next call to Consume or Write.
+  std::string_view Peek() const;
+  void Consume(std::size_t n);
+
+  std::size_t size() const;
+  std::size_t capacity() const;
+  bool paused() const;
+
+ private:
+  std::unique_ptr<char[]> buffer_;
+  std::size_t capacity_;
+  std::size_t head_ = 0;
+  std::size_t size_ = 0;
+  bool paused_ = false;
+};
+
+// Writes each chunk straight from libcurl's buffer to a blocking file
+// descriptor. The descriptor is not owned.
+class FileDescriptorSink {
+ public:
+  explicit FileDescriptorSink(int fd);
+
+  bool Write(std::string_view chunk, size_t *flags, Status *error);
+
+  std::size_t bytes_written() const;
+
+ private:
+  int fd_;
+  std::size_t bytes_written_ = 0;
+};
+
+// Feeds each chunk straight into an incremental parser (e.g. JSONParser or
+// YAJLParser) as it arrives, so the body is never buffered. Parser must have a
+// member Status Parse(std::string_view). The parser is not owned, and the
+// caller is responsible for calling its Complete once the transfer finishes.
+//
+// To apply backpressure, call RequestPause (typically from a parser callback
+// when downstream consumers are full). The next chunk is not parsed; instead
+// the transfer is paused with CURL_WRITEFUNC_PAUSE until Resume is called.
+// Pausing is only useful for transfers driven by CurlMulti.
+template <typename Parser>
+class ParserSink {
+ public:
+  explicit ParserSink(Parser *parser);
+
+  bool Write(std::string_view chunk, size_t *flags, Status *error);
+
+  void RequestPause();
+  Status Resume(CURL *handle);
+  bool paused() const;
+
+ private:
+  Parser *parser_;
+  bool pause_requested_ = false;
+  bool paused_ = false;
+};
+
+// implementation details below
+
+template <typename Parser>
+ParserSink<Parser>::ParserSink(Parser *parser) : parser_(parser) {}
+
+template <typename Parser>
+bool ParserSink<Parser>::Write(std::string_view chunk, size_t *flags,
+                               Status *error) {
+  if (pause_requested_) {
+    paused_ = true;
+    *flags = CURL_WRITEFUNC_PAUSE;
+    return true;
+  }
+  Status st = parser_->Parse(chunk);
+  if (!st.ok()) {
+    *error = std::move(st);
+    return false;
+  }
+  return true;
+}
+
+template <typename Parser>
+void ParserSink<Parser>::RequestPause() { pause_requested_ = true; }
+
+template <typename Parser>
+Status ParserSink<Parser>::Resume(CURL *handle) {
+  pause_requested_ = false;
+  if (!paused_) return OkStatus();
+  paused_ = false;
+  return CurlCodeToStatus(curl_easy_pause(handle, CURLPAUSE_CONT), handle);
+}
+
+template <typename Parser>
+bool ParserSink<Parser>::paused() const { return paused_; }
+
+}  // namespace rhutil
+
+#endif  // RHUTIL_CURL_SINKS_H_
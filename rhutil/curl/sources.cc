@@ -0,0 +1,139 @@
+#include "rhutil/curl/sources.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <utility>
+
+#include "rhutil/errno.h"
+#include "rhutil/cleanup.h"
+
+namespace rhutil {
+
+MemorySource::MemorySource(std::string_view data) : data_(data) {}
+
+bool MemorySource::Read(absl::Span<char> buffer, size_t *size, Status*) {
+  *size = std::min(buffer.size(), data_.size() - offset_);
+  if (*size != 0) std::memcpy(buffer.data(), data_.data() + offset_, *size);
+  offset_ += *size;
+  return true;
+}
+
+std::size_t MemorySource::size() const { return data_.size(); }
+
+IovecSource::IovecSource(absl::Span<const iovec> iov) : iov_(iov) {}
+
+bool IovecSource::Read(absl::Span<char> buffer, size_t *size, Status*) {
+  *size = 0;
+  while (index_ < iov_.size() && *size < buffer.size()) {
+    const iovec &vec = iov_[index_];
+    std::size_t n = std::min(buffer.size() - *size, vec.iov_len - offset_);
+    std::memcpy(buffer.data() + *size,
+                static_cast<const char*>(vec.iov_base) + offset_, n);
+    *size += n;
+    offset_ += n;
+    if (offset_ == vec.iov_len) {
+      ++index_;
+      offset_ = 0;
+    }
+  }
+  return true;
+}
+
+std::size_t IovecSource::size() const {
+  std::size_t size = 0;
+  for (const iovec &vec : iov_) size += vec.iov_len;
+  return size;
+}
+
+MappedFileSource::~MappedFileSource() { Unmap(); }
+
+MappedFileSource::MappedFileSource(MappedFileSource &&o)
+  : data_(std::exchange(o.data_, nullptr)), size_(std::exchange(o.size_, 0)),
+    offset_(std::exchange(o.offset_, 0)) {}
+
+MappedFileSource &MappedFileSource::operator=(MappedFileSource &&o) {
+  if (this == &o) return *this;
+  Unmap();
+  data_ = std::exchange(o.data_, nullptr);
+  size_ = std::exchange(o.size_, 0);
+  offset_ = std::exchange(o.offset_, 0);
+  return *this;
+}
+
+void MappedFileSource::Unmap() {
+  if (data_ == nullptr) return;
+  munmap(const_cast<char*>(data_), size_);
+  data_ = nullptr;
+}
+
+StatusOr<MappedFileSource> MappedFileSource::Open(std::string_view path) {
+  const std::string path_str(path);
+  int fd = open(path_str.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd == -1) {
+    return StatusBuilder(ErrnoAsStatus()) << "Failed to open " << path;
+  }
+  // The mapping stays valid after the descriptor is closed.
+  Cleanup close_fd([fd] { close(fd); });
+
+  struct stat st;
+  if (fstat(fd, &st) == -1) {
+    return StatusBuilder(ErrnoAsStatus()) << "Failed to stat " << path;
+  }
+  MappedFileSource source;
+  source.size_ = st.st_size;
+  // mmap rejects empty mappings, and there is nothing to map anyway.
+  if (source.size_ == 0) return source;
+
+  void *data = mmap(nullptr, source.size_, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (data == MAP_FAILED) {
+    return StatusBuilder(ErrnoAsStatus()) << "Failed to mmap " << path;
+  }
+  source.data_ = static_cast<const char*>(data);
+  // Only a hint, so failure is harmless.
+  madvise(data, source.size_, MADV_SEQUENTIAL);
+  return source;
+}
+
+bool MappedFileSource::Read(absl::Span<char> buffer, size_t *size, Status*) {
+  *size = std::min(buffer.size(), size_ - offset_);
+  if (*size != 0) std::memcpy(buffer.data(), data_ + offset_, *size);
+  offset_ += *size;
+  return true;
+}
+
+std::size_t MappedFileSource::size() const { return size_; }
+
+ProducerSource::ProducerSource(Producer producer)
+  : producer_(std::move(producer)) {}
+
+bool ProducerSource::Read(absl::Span<char> buffer, size_t *size,
+                          Status *error) {
+  *size = 0;
+  if (done_) return true;
+  Status st = producer_(buffer, size, &done_);
+  if (!st.ok()) {
+    *error = std::move(st);
+    return false;
+  }
+  if (*size == 0 && !done_) {
+    paused_ = true;
+    *size = CURL_READFUNC_PAUSE;
+  }
+  return true;
+}
+
+Status ProducerSource::Resume(CURL *handle) {
+  if (!paused_) return OkStatus();
+  paused_ = false;
+  return CurlCodeToStatus(curl_easy_pause(handle, CURLPAUSE_CONT), handle);
+}
+
+bool ProducerSource::paused() const { return paused_; }
+
+}  // namespace rhutil
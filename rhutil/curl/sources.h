@@ -0,0 +1,104 @@
+#ifndef RHUTIL_CURL_SOURCES_H_
+#define RHUTIL_CURL_SOURCES_H_
+
+#include <sys/uio.h>
+
+#include <cstddef>
+#include <functional>
+#include <string_view>
+
+#include "rhutil/status.h"
+#include "rhutil/curl/curl.h"
+#include "curl/curl.h"
+#include "absl/types/span.h"
+
+namespace rhutil {
+
+// Read sources for use with CurlEasySetReadSource. Each copies straight from
+// the caller's memory into libcurl's upload buffer, so the body is never
+// duplicated. None of these are thread-safe.
+
+// Uploads a caller-owned buffer.
+class MemorySource {
+ public:
+  explicit MemorySource(std::string_view data);
+
+  bool Read(absl::Span<char> buffer, size_t *size, Status *error);
+
+  std::size_t size() const;
+
+ private:
+  std::string_view data_;
+  std::size_t offset_ = 0;
+};
+
+// Uploads the concatenation of caller-owned buffers, e.g. a header and a
+// payload, without first joining them.
+class IovecSource {
+ public:
+  explicit IovecSource(absl::Span<const iovec> iov);
+
+  bool Read(absl::Span<char> buffer, size_t *size, Status *error);
+
+  std::size_t size() const;
+
+ private:
+  absl::Span<const iovec> iov_;
+  std::size_t index_ = 0;
+  std::size_t offset_ = 0;
+};
+
+// Uploads a file through a read-only memory mapping, so large bodies are
+// paged in from the page cache rather than read into a heap buffer.
+class MappedFileSource {
+ public:
+  MappedFileSource() = default;
+  ~MappedFileSource();
+
+  static StatusOr<MappedFileSource> Open(std::string_view path);
+
+  MappedFileSource(MappedFileSource &&);
+  MappedFileSource &operator=(MappedFileSource &&);
+  MappedFileSource(const MappedFileSource &) = delete;
+  MappedFileSource &operator=(const MappedFileSource &) = delete;
+
+  bool Read(absl::Span<char> buffer, size_t *size, Status *error);
+
+  std::size_t size() const;
+
+ private:
+  void Unmap();
+
+  const char *data_ = nullptr;
+  std::size_t size_ = 0;
+  std::size_t offset_ = 0;
+};
+
+// Pulls the body from a producer as libcurl asks for it. The producer copies
+// up to buffer.size() bytes into buffer, sets *size to the number copied and
+// sets *done once the body is complete.
+//
+// A producer which has nothing to offer yet may copy nothing without setting
+// *done. The transfer is then paused (CURL_READFUNC_PAUSE) until Resume is
+// called. Pausing is only useful for transfers driven by CurlMulti.
+class ProducerSource {
+ public:
+  using Producer =
+      std::function<Status(absl::Span<char> buffer, size_t *size, bool *done)>;
+
+  explicit ProducerSource(Producer producer);
+
+  bool Read(absl::Span<char> buffer, size_t *size, Status *error);
+
+  Status Resume(CURL *handle);
+  bool paused() const;
+
+ private:
+  Producer producer_;
+  bool done_ = false;
+  bool paused_ = false;
+};
+
+}  // namespace rhutil
+
+#endif  // RHUTIL_CURL_SOURCES_H_
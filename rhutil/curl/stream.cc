@@ -0,0 +1,365 @@
+#include "rhutil/curl/stream.h"
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+#include "rhutil/cleanup.h"
+#include "rhutil/curl/retry.h"
+#include "absl/strings/ascii.h"
+#include "absl/strings/match.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/strip.h"
+#include "absl/time/clock.h"
+
+namespace rhutil {
+namespace {
+
+constexpr std::string_view kByteOrderMark = "\xEF\xBB\xBF";
+
+// How often a reconnect delay checks for cancellation.
+constexpr absl::Duration kCancellationPoll = absl::Milliseconds(50);
+
+Status TooLarge(std::string_view what, std::size_t limit) {
+  return ResourceExhaustedError(
+      absl::StrCat(what, " longer than ", limit, " bytes"));
+}
+
+// Feeds a connection's body to the parser, but only once the response has
+// turned out to be an event stream. Error bodies are discarded.
+class EventStreamSink {
+ public:
+  EventStreamSink(CURL *handle, EventStreamParser *parser)
+    : handle_(handle), parser_(parser) {}
+
+  bool Write(std::string_view chunk, size_t*, Status *error) {
+    if (!checked_) {
+      checked_ = true;
+      Status st = Check();
+      if (!st.ok()) {
+        *error = std::move(st);
+        failed_ = true;
+        return false;
+      }
+    }
+    if (!streaming_) return true;
+    Status st = parser_->Parse(chunk);
+    if (!st.ok()) {
+      *error = std::move(st);
+      failed_ = true;
+      return false;
+    }
+    return true;
+  }
+
+  // Whether the transfer was aborted by the sink, rather than by libcurl.
+  bool failed() const { return failed_; }
+
+ private:
+  Status Check() {
+    long response_code = 0;
+    RETURN_IF_ERROR(CurlEasyGetInfo(handle_, CURLINFO_RESPONSE_CODE,
+                                    &response_code));
+    if (response_code != 200) return OkStatus();
+    char *content_type = nullptr;
+    RETURN_IF_ERROR(CurlEasyGetInfo(handle_, CURLINFO_CONTENT_TYPE,
+                                    &content_type));
+    if (content_type == nullptr ||
+        !absl::StartsWithIgnoreCase(content_type, "text/event-stream")) {
+      return FailedPreconditionErrorBuilder()
+          << "Not an event stream: Content-Type "
+          << (content_type == nullptr ? "missing" : content_type);
+    }
+    streaming_ = true;
+    return OkStatus();
+  }
+
+  CURL *const handle_;
+  EventStreamParser *const parser_;
+  bool checked_ = false;
+  bool streaming_ = false;
+  bool failed_ = false;
+};
+
+}  // namespace
+
+EventStreamParser::EventStreamParser(Callback callback,
+                                     std::size_t max_event_size)
+  : callback_(std::move(callback)), max_event_size_(max_event_size) {}
+
+Status EventStreamParser::Parse(std::string_view chunk) {
+  if (skip_lf_ && !chunk.empty()) {
+    skip_lf_ = false;
+    absl::ConsumePrefix(&chunk, "\n");
+  }
+  while (!chunk.empty()) {
+    const auto eol = chunk.find_first_of("\r\n");
+    if (eol == std::string_view::npos) {
+      if (line_.size() + chunk.size() > max_event_size_) {
+        return TooLarge("Event stream line", max_event_size_);
+      }
+      line_.append(chunk.data(), chunk.size());
+      return OkStatus();
+    }
+
+    std::string_view line = chunk.substr(0, eol);
+    if (!line_.empty()) {
+      if (line_.size() + line.size() > max_event_size_) {
+        return TooLarge("Event stream line", max_event_size_);
+      }
+      line_.append(line.data(), line.size());
+      line = line_;
+    }
+    Status st = ProcessLine(line);
+    line_.clear();
+    RETURN_IF_ERROR(st);
+
+    // A CR, LF or CRLF ends the line.
+    std::size_t next = eol + 1;
+    if (chunk[eol] == '\r') {
+      if (next == chunk.size()) {
+        skip_lf_ = true;
+      } else if (chunk[next] == '\n') {
+        ++next;
+      }
+    }
+    chunk.remove_prefix(next);
+  }
+  return OkStatus();
+}
+
+Status EventStreamParser::ProcessLine(std::string_view line) {
+  if (stream_start_) {
+    stream_start_ = false;
+    absl::ConsumePrefix(&line, kByteOrderMark);
+  }
+  if (line.empty()) return Dispatch();
+  // A comment, often sent to keep the connection alive.
+  if (line.front() == ':') return OkStatus();
+
+  const auto colon = std::min(line.find(':'), line.size());
+  std::string_view field = line.substr(0, colon);
+  std::string_view value = line.substr(std::min(colon + 1, line.size()));
+  absl::ConsumePrefix(&value, " ");
+
+  if (field == "data") {
+    if (data_.size() + value.size() + 1 > max_event_size_) {
+      return TooLarge("Event data", max_event_size_);
+    }
+    data_.append(value.data(), value.size());
+    data_.push_back('\n');
+  } else if (field == "event") {
+    type_.assign(value.data(), value.size());
+  } else if (field == "id") {
+    // Only takes effect once the event is complete, so a stream which ends
+    // mid-event resumes from the last event actually delivered.
+    if (value.find('\0') == std::string_view::npos) {
+      pending_id_.assign(value.data(), value.size());
+      has_pending_id_ = true;
+    }
+  } else if (field == "retry") {
+    int64_t ms = 0;
+    if (!value.empty() &&
+        std::all_of(value.begin(), value.end(), absl::ascii_isdigit) &&
+        absl::SimpleAtoi(value, &ms)) {
+      retry_ = absl::Milliseconds(ms);
+    }
+  }
+  // Other fields are ignored.
+  return OkStatus();
+}
+
+Status EventStreamParser::Dispatch() {
+  if (has_pending_id_) {
+    last_event_id_.swap(pending_id_);
+    has_pending_id_ = false;
+  }
+  if (data_.empty()) {
+    type_.clear();
+    return OkStatus();
+  }
+  ServerSentEvent event;
+  event.id = last_event_id_;
+  event.type = type_.empty() ? std::string_view("message") : type_;
+  // Without the LF which followed the last data line.
+  event.data = std::string_view(data_.data(), data_.size() - 1);
+  Status st = callback_(event);
+  data_.clear();
+  type_.clear();
+  return st;
+}
+
+void EventStreamParser::Reset() {
+  line_.clear();
+  data_.clear();
+  type_.clear();
+  has_pending_id_ = false;
+  stream_start_ = true;
+  skip_lf_ = false;
+}
+
+const std::string &EventStreamParser::last_event_id() const {
+  return last_event_id_;
+}
+
+void EventStreamParser::set_last_event_id(std::string id) {
+  last_event_id_ = std::move(id);
+}
+
+std::optional<absl::Duration> EventStreamParser::retry() const {
+  return retry_;
+}
+
+LineParser::LineParser(Callback callback, std::size_t max_line_size)
+  : callback_(std::move(callback)), max_line_size_(max_line_size) {}
+
+Status LineParser::Parse(std::string_view chunk) {
+  while (!chunk.empty()) {
+    const auto eol = chunk.find('\n');
+    if (eol == std::string_view::npos) {
+      if (line_.size() + chunk.size() > max_line_size_) {
+        return TooLarge("Line", max_line_size_);
+      }
+      line_.append(chunk.data(), chunk.size());
+      return OkStatus();
+    }
+
+    std::string_view line = chunk.substr(0, eol);
+    if (!line_.empty()) {
+      if (line_.size() + line.size() > max_line_size_) {
+        return TooLarge("Line", max_line_size_);
+      }
+      line_.append(line.data(), line.size());
+      line = line_;
+    }
+    Status st = Deliver(line);
+    line_.clear();
+    RETURN_IF_ERROR(st);
+    chunk.remove_prefix(eol + 1);
+  }
+  return OkStatus();
+}
+
+Status LineParser::Complete() {
+  Status st = Deliver(line_);
+  line_.clear();
+  return st;
+}
+
+void LineParser::Reset() { line_.clear(); }
+
+Status LineParser::Deliver(std::string_view line) {
+  absl::ConsumeSuffix(&line, "\r");
+  if (line.empty()) return OkStatus();
+  return callback_(line);
+}
+
+EventStreamClient::EventStreamClient() : EventStreamClient(Options()) {}
+
+EventStreamClient::EventStreamClient(Options options)
+  : options_(std::move(options)) {}
+
+Status EventStreamClient::Run(
+    CURL *handle, const char *url,
+    const EventStreamParser::Callback &callback,
+    absl::Span<const std::string_view> request_headers) {
+  bool received = false;
+  EventStreamParser parser(
+      [&callback, &received](const ServerSentEvent &event) {
+        received = true;
+        return callback(event);
+      },
+      options_.max_event_size);
+  parser.set_last_event_id(last_event_id_);
+  Cleanup save([this, &parser] {
+    last_event_id_ = parser.last_event_id();
+    if (parser.retry().has_value()) retry_ = parser.retry();
+  });
+  Cleanup unset_headers([handle] {
+    CurlEasySetopt(handle, CURLOPT_HTTPHEADER,
+                   static_cast<curl_slist*>(nullptr)).IgnoreError();
+  });
+  const bool has_context =
+      options_.context.deadline != absl::InfiniteFuture() ||
+      options_.context.cancellation != nullptr;
+
+  std::vector<std::string> lines;
+  std::vector<std::string_view> line_views;
+  for (int failures = 0;;) {
+    lines.assign({"Accept: text/event-stream", "Cache-Control: no-cache"});
+    if (!parser.last_event_id().empty()) {
+      lines.push_back(absl::StrCat("Last-Event-ID: ", parser.last_event_id()));
+    }
+    for (std::string_view line : request_headers) lines.emplace_back(line);
+    line_views.assign(lines.begin(), lines.end());
+    auto header_list = NewCurlSList(line_views);
+
+    EventStreamSink sink(handle, &parser);
+    if (has_context) {
+      RETURN_IF_ERROR(CurlEasySetContext(handle, options_.context));
+    }
+    RETURN_IF_ERROR(CurlEasySetopt(handle, CURLOPT_URL, url));
+    RETURN_IF_ERROR(
+        CurlEasySetopt(handle, CURLOPT_HTTPHEADER, header_list.get()));
+    RETURN_IF_ERROR(CurlEasySetWriteSink(handle, &sink));
+    received = false;
+    Status status = CurlEasyPerform(handle);
+    parser.Reset();
+
+    if (sink.failed()) return status;
+    const CurlCancellation *cancellation = options_.context.cancellation;
+    if ((cancellation != nullptr && cancellation->cancelled()) ||
+        absl::Now() >= options_.context.deadline) {
+      return status;
+    }
+    long response_code = 0;
+    RETURN_IF_ERROR(CurlEasyGetInfo(handle, CURLINFO_RESPONSE_CODE,
+                                    &response_code));
+    // The server's way of saying the stream is over for good.
+    if (response_code == 204) return OkStatus();
+    if (response_code >= 300 && !IsRetryableHTTPCode(response_code)) {
+      return status;
+    }
+    if (status.ok()) status = UnavailableError("Event stream ended");
+
+    failures = received ? 0 : failures + 1;
+    if (options_.max_attempts > 0 && failures >= options_.max_attempts) {
+      return StatusBuilder(std::move(status))
+          << "; giving up after " << failures
+          << " connections without an event";
+    }
+    // A retry field longer than max_reconnect_delay is still honoured.
+    const absl::Duration base = parser.retry().value_or(
+        retry_.value_or(options_.reconnect_delay));
+    const absl::Duration limit = std::max(base, options_.max_reconnect_delay);
+    absl::Duration delay = base;
+    for (int i = 1; i < failures && delay < limit; ++i) delay *= 2;
+    RETURN_IF_ERROR(Sleep(std::min(delay, limit)));
+  }
+}
+
+Status EventStreamClient::Sleep(absl::Duration delay) const {
+  const absl::Time until = absl::Now() + delay;
+  if (until > options_.context.deadline) {
+    return DeadlineExceededError("Deadline would pass before reconnecting");
+  }
+  const CurlCancellation *cancellation = options_.context.cancellation;
+  for (absl::Time now = absl::Now(); now < until; now = absl::Now()) {
+    if (cancellation != nullptr && cancellation->cancelled()) {
+      return CancelledError("Cancelled before reconnecting");
+    }
+    absl::SleepFor(std::min(until - now, kCancellationPoll));
+  }
+  return OkStatus();
+}
+
+const std::string &EventStreamClient::last_event_id() const {
+  return last_event_id_;
+}
+
+void EventStreamClient::set_last_event_id(std::string id) {
+  last_event_id_ = std::move(id);
+}
+
+}  // namespace rhutil
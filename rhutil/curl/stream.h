@@ -0,0 +1,183 @@
+#ifndef RHUTIL_CURL_STREAM_H_
+#define RHUTIL_CURL_STREAM_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <string>
+#include <string_view>
+
+#include "rhutil/status.h"
+#include "rhutil/curl/curl.h"
+#include "absl/time/time.h"
+#include "absl/types/span.h"
+
+namespace rhutil {
+
+// Incremental parsers for streamed response bodies, which may be fed to
+// ParserSink, and a Server-Sent Events client built on them. None of these
+// are thread-safe.
+
+inline constexpr std::size_t kDefaultMaxEventSize = 1 << 20;
+
+// One Server-Sent Event. The views are valid until the callback receiving it
+// returns.
+struct ServerSentEvent {
+  // The stream's last event ID as of this event, which may have been set by
+  // an earlier one.
+  std::string_view id;
+  // "message" unless the event named another type.
+  std::string_view type;
+  std::string_view data;
+};
+
+// Parses a text/event-stream body as it arrives, delivering each complete
+// event to a callback. Lines which arrive whole within one chunk are parsed in
+// place; only lines split across chunks, and event data, are copied, into
+// buffers which are reused from one event to the next.
+class EventStreamParser {
+ public:
+  // An error stops parsing and is returned by Parse.
+  using Callback = std::function<Status(const ServerSentEvent&)>;
+
+  // Parse fails with ResourceExhausted if a line, or an event's data, grows
+  // past max_event_size bytes. Either buffer may reach that size, so this
+  // bounds memory per stream at about twice it.
+  explicit EventStreamParser(Callback callback,
+                             std::size_t max_event_size = kDefaultMaxEventSize);
+
+  EventStreamParser(const EventStreamParser &) = delete;
+  EventStreamParser &operator=(const EventStreamParser &) = delete;
+
+  Status Parse(std::string_view chunk);
+
+  // Discards any partly received event, including its id field, as the
+  // stream ending does. The last event ID and reconnection time are kept.
+  void Reset();
+
+  const std::string &last_event_id() const;
+  void set_last_event_id(std::string id);
+  // The reconnection time last sent in a retry field, if any.
+  std::optional<absl::Duration> retry() const;
+
+ private:
+  Status ProcessLine(std::string_view line);
+  Status Dispatch();
+
+  const Callback callback_;
+  const std::size_t max_event_size_;
+  // The start of a line not yet ended.
+  std::string line_;
+  std::string data_;
+  std::string type_;
+  std::string last_event_id_;
+  // An id field of the event being received, which becomes the last event
+  // ID when the event ends.
+  std::string pending_id_;
+  bool has_pending_id_ = false;
+  std::optional<absl::Duration> retry_;
+  // Whether the next byte starts the stream, and so may be a byte order mark.
+  bool stream_start_ = true;
+  // Whether the last chunk ended in a CR, so a LF starting the next one ends
+  // no further line.
+  bool skip_lf_ = false;
+};
+
+// Splits a body into lines as it arrives, for newline-delimited formats such
+// as NDJSON. Lines end in LF, and a CR before it is dropped. Empty lines are
+// skipped. As with EventStreamParser, only lines split across chunks are
+// copied.
+class LineParser {
+ public:
+  // The line is valid until the callback returns. An error stops parsing and
+  // is returned by Parse.
+  using Callback = std::function<Status(std::string_view line)>;
+
+  // Parse fails with ResourceExhausted if a line grows past max_line_size
+  // bytes.
+  explicit LineParser(Callback callback,
+                      std::size_t max_line_size = kDefaultMaxEventSize);
+
+  LineParser(const LineParser &) = delete;
+  LineParser &operator=(const LineParser &) = delete;
+
+  Status Parse(std::string_view chunk);
+
+  // Delivers a final line which was not followed by a LF. Call once the
+  // body is complete.
+  Status Complete();
+  // Discards any partly received line.
+  void Reset();
+
+ private:
+  Status Deliver(std::string_view line);
+
+  const Callback callback_;
+  const std::size_t max_line_size_;
+  std::string line_;
+};
+
+// Follows a Server-Sent Events stream, reconnecting whenever the connection
+// ends or fails, and resuming with a Last-Event-ID header from the last event
+// ID received.
+class EventStreamClient {
+ public:
+  struct Options {
+    // How long to wait before reconnecting, until the server sends a retry
+    // field.
+    absl::Duration reconnect_delay = absl::Seconds(3);
+    // The delay doubles for each consecutive connection which ends without an
+    // event, up to this.
+    absl::Duration max_reconnect_delay = absl::Seconds(60);
+    // Consecutive connections which may end without an event before Run
+    // gives up, or 0 to never give up.
+    int max_attempts = 0;
+    std::size_t max_event_size = kDefaultMaxEventSize;
+    // Ends the stream, both during connections and while waiting to
+    // reconnect. See CurlEasySetContext.
+    CurlContext context;
+  };
+
+  EventStreamClient();
+  explicit EventStreamClient(Options options);
+
+  EventStreamClient(const EventStreamClient &) = delete;
+  EventStreamClient &operator=(const EventStreamClient &) = delete;
+
+  // Streams events from url on handle, which may be configured beforehand
+  // (e.g. for HTTP/2 or authentication), until:
+  //
+  //  - callback fails, or the stream is malformed or not text/event-stream,
+  //    which returns that error.
+  //  - the server responds 204 No Content, which returns OK.
+  //  - the server responds with an HTTP error which IsRetryableHTTPCode does
+  //    not accept, which returns it.
+  //  - the context is cancelled or its deadline passes.
+  //  - max_attempts connections in a row end without an event, which
+  //    returns the last one's error.
+  //
+  // request_headers are "Name: value" lines sent with every request. Run
+  // sets the URL, HTTP headers and write sink of handle, so those must be set
+  // again before it is used for anything else.
+  Status Run(CURL *handle, const char *url,
+             const EventStreamParser::Callback &callback,
+             absl::Span<const std::string_view> request_headers = {});
+
+  // The ID sent with the next connection. It persists across calls to Run,
+  // and may be set to resume a stream followed earlier.
+  const std::string &last_event_id() const;
+  void set_last_event_id(std::string id);
+
+ private:
+  // Fails if the context is cancelled, or would pass its deadline first.
+  Status Sleep(absl::Duration delay) const;
+
+  const Options options_;
+  std::string last_event_id_;
+  std::optional<absl::Duration> retry_;
+};
+
+}  // namespace rhutil
+
+#endif  // RHUTIL_CURL_STREAM_H_
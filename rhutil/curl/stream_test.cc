@@ -0,0 +1,223 @@
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "rhutil/curl/curl.h"
+#include "rhutil/curl/stream.h"
+#include "rhutil/curl/testing/loopback_server.h"
+#include "rhutil/testing/assertions.h"
+#include "gtest/gtest.h"
+#include "absl/strings/str_cat.h"
+#include "absl/synchronization/mutex.h"
+
+namespace rhutil {
+namespace {
+
+struct Event {
+  std::string id;
+  std::string type;
+  std::string data;
+
+  bool operator==(const Event &o) const {
+    return id == o.id && type == o.type && data == o.data;
+  }
+};
+
+std::ostream &operator<<(std::ostream &os, const Event &event) {
+  return os << "{id=" << event.id << " type=" << event.type
+            << " data=" << event.data << "}";
+}
+
+EventStreamParser::Callback AppendTo(std::vector<Event> *events) {
+  return [events](const ServerSentEvent &event) {
+    events->push_back({std::string(event.id), std::string(event.type),
+                       std::string(event.data)});
+    return OkStatus();
+  };
+}
+
+// Parses stream in chunks of every size from 1 byte to all of it, expecting
+// the same events each time.
+void ExpectEvents(std::string_view stream, const std::vector<Event> &expected) {
+  for (std::size_t chunk_size = 1; chunk_size <= stream.size(); ++chunk_size) {
+    SCOPED_TRACE(chunk_size);
+    std::vector<Event> events;
+    EventStreamParser parser(AppendTo(&events));
+    for (std::size_t i = 0; i < stream.size(); i += chunk_size) {
+      ASSERT_TRUE(IsOk(parser.Parse(stream.substr(i, chunk_size))));
+    }
+    EXPECT_EQ(events, expected);
+  }
+}
+
+TEST(EventStreamParserTest, SplitAcrossChunks) {
+  ExpectEvents(
+      "id: 1\nevent: update\ndata: first\ndata: second\n\n"
+      ": a comment\ndata:no space\n\n"
+      "data\n\n",
+      {{"1", "update", "first\nsecond"},
+       {"1", "message", "no space"},
+       {"1", "message", ""}});
+}
+
+TEST(EventStreamParserTest, LineEndings) {
+  ExpectEvents("data: lf\n\ndata: crlf\r\n\r\ndata: cr\r\rdata: mixed\r\n\n",
+               {{"", "message", "lf"},
+                {"", "message", "crlf"},
+                {"", "message", "cr"},
+                {"", "message", "mixed"}});
+}
+
+TEST(EventStreamParserTest, ByteOrderMark) {
+  // Only a mark starting the stream is dropped.
+  ExpectEvents("\xEF\xBB\xBF" "data: a\n\n\xEF\xBB\xBF" "data: b\n\n",
+               {{"", "message", "a"}});
+}
+
+TEST(EventStreamParserTest, IdTakesEffectWhenEventEnds) {
+  std::vector<Event> events;
+  EventStreamParser parser(AppendTo(&events));
+  ASSERT_TRUE(IsOk(parser.Parse("id: 1\ndata: a\n\nid: 2\ndata: b\n")));
+  EXPECT_EQ(parser.last_event_id(), "1");
+  parser.Reset();
+  EXPECT_EQ(events, (std::vector<Event>{{"1", "message", "a"}}));
+  EXPECT_EQ(parser.last_event_id(), "1");
+
+  // An event without data still sets the ID.
+  ASSERT_TRUE(IsOk(parser.Parse("id: 3\n\ndata: c\n\n")));
+  EXPECT_EQ(events.back(), (Event{"3", "message", "c"}));
+}
+
+TEST(EventStreamParserTest, Retry) {
+  EventStreamParser parser([](const ServerSentEvent&) { return OkStatus(); });
+  ASSERT_TRUE(IsOk(parser.Parse("retry: 1500\nretry: soon\n")));
+  EXPECT_EQ(parser.retry(), absl::Milliseconds(1500));
+}
+
+TEST(EventStreamParserTest, SizeLimits) {
+  auto ignore = [](const ServerSentEvent&) { return OkStatus(); };
+  EventStreamParser line_limit(ignore, 8);
+  EXPECT_EQ(line_limit.Parse("data: 12").code(), StatusCode::kOk);
+  EXPECT_EQ(line_limit.Parse("3").code(), StatusCode::kResourceExhausted);
+
+  EventStreamParser data_limit(ignore, 8);
+  EXPECT_EQ(data_limit.Parse("data: 1234\ndata: 5678\n").code(),
+            StatusCode::kResourceExhausted);
+}
+
+TEST(EventStreamParserTest, CallbackErrorStopsParsing) {
+  EventStreamParser parser([](const ServerSentEvent&) {
+    return CancelledError("enough");
+  });
+  EXPECT_EQ(parser.Parse("data: a\n\n").code(), StatusCode::kCancelled);
+}
+
+TEST(LineParserTest, SplitsLines) {
+  const std::string_view body = "{\"a\":1}\r\n\n{\"b\":2}\n{\"c\":3}";
+  for (std::size_t chunk_size = 1; chunk_size <= body.size(); ++chunk_size) {
+    SCOPED_TRACE(chunk_size);
+    std::vector<std::string> lines;
+    LineParser parser([&lines](std::string_view line) {
+      lines.emplace_back(line);
+      return OkStatus();
+    });
+    for (std::size_t i = 0; i < body.size(); i += chunk_size) {
+      ASSERT_TRUE(IsOk(parser.Parse(body.substr(i, chunk_size))));
+    }
+    ASSERT_TRUE(IsOk(parser.Complete()));
+    EXPECT_EQ(lines, (std::vector<std::string>{
+        "{\"a\":1}", "{\"b\":2}", "{\"c\":3}"}));
+  }
+}
+
+TEST(LineParserTest, SizeLimit) {
+  LineParser parser([](std::string_view) { return OkStatus(); }, 4);
+  EXPECT_EQ(parser.Parse("1234\n").code(), StatusCode::kOk);
+  EXPECT_EQ(parser.Parse("12345").code(), StatusCode::kResourceExhausted);
+}
+
+// Serves an event stream which drops the first connection in the middle of
+// an event, then resumes after whatever Last-Event-ID the client sends, and
+// finally ends the stream with a 204.
+class ResumingServer {
+ public:
+  LoopbackServer::ServeFunction Serve() {
+    return [this](int fd) {
+      std::string request;
+      char buffer[4096];
+      while (request.find("\r\n\r\n") == std::string::npos) {
+        ssize_t n = read(fd, buffer, sizeof(buffer));
+        if (n <= 0) return;
+        request.append(buffer, n);
+      }
+      constexpr std::string_view kOK =
+          "HTTP/1.1 200 OK\r\nContent-Type: text/event-stream\r\n"
+          "Connection: close\r\n\r\n";
+      std::string response;
+      {
+        absl::MutexLock lock(&mu_);
+        constexpr char kHeader[] = "Last-Event-ID: ";
+        auto start = request.find(kHeader);
+        if (start == std::string::npos) {
+          last_event_ids_.emplace_back();
+        } else {
+          start += sizeof(kHeader) - 1;
+          last_event_ids_.push_back(
+              request.substr(start, request.find('\r', start) - start));
+        }
+        if (last_event_ids_.size() == 1) {
+          response = absl::StrCat(kOK, "retry: 1\nid: 1\ndata: a\n\n",
+                                  "id: 2\ndata: b");
+        } else if (last_event_ids_.back() == "1") {
+          response = absl::StrCat(kOK, "id: 2\ndata: b\n\n");
+        } else {
+          response = "HTTP/1.1 204 No Content\r\nConnection: close\r\n\r\n";
+        }
+      }
+      send(fd, response.data(), response.size(), MSG_NOSIGNAL);
+      shutdown(fd, SHUT_WR);
+    };
+  }
+
+  std::vector<std::string> last_event_ids() {
+    absl::MutexLock lock(&mu_);
+    return last_event_ids_;
+  }
+
+ private:
+  absl::Mutex mu_;
+  std::vector<std::string> last_event_ids_ GUARDED_BY(mu_);
+};
+
+TEST(EventStreamClientTest, ResumesAfterLastDeliveredEvent) {
+  ASSERT_TRUE(IsOk(CurlGlobalInit()));
+  ResumingServer resuming;
+  LoopbackServer server(resuming.Serve());
+  EventStreamClient client;
+  std::vector<Event> events;
+  auto handle = CurlEasyInit();
+  ASSERT_TRUE(IsOk(client.Run(handle.get(), server.URL("/events").c_str(),
+                              AppendTo(&events))));
+  EXPECT_EQ(events, (std::vector<Event>{{"1", "message", "a"},
+                                        {"2", "message", "b"}}));
+  EXPECT_EQ(resuming.last_event_ids(),
+            (std::vector<std::string>{"", "1", "2"}));
+  EXPECT_EQ(client.last_event_id(), "2");
+}
+
+TEST(EventStreamClientTest, RejectsOtherContentTypes) {
+  ASSERT_TRUE(IsOk(CurlGlobalInit()));
+  LoopbackServer server(&ServeHTTP1);
+  EventStreamClient client;
+  auto handle = CurlEasyInit();
+  EXPECT_EQ(client.Run(handle.get(), server.URL().c_str(),
+                       [](const ServerSentEvent&) { return OkStatus(); })
+                .code(),
+            StatusCode::kFailedPrecondition);
+}
+
+}  // namespace
+}  // namespace rhutil
@@ -0,0 +1,314 @@
+#include "rhutil/curl/testing/loopback_server.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <utility>
+
+#include "rhutil/status.h"
+#include "absl/strings/match.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_split.h"
+#include "absl/time/clock.h"
+
+namespace rhutil {
+namespace {
+
+constexpr std::string_view kPreface = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+
+enum FrameType : uint8_t {
+  kData = 0x0,
+  kHeaders = 0x1,
+  kSettings = 0x4,
+  kPing = 0x6,
+  kGoAway = 0x7,
+  kContinuation = 0x9,
+};
+
+constexpr uint8_t kEndStream = 0x1;
+constexpr uint8_t kAck = 0x1;
+constexpr uint8_t kEndHeaders = 0x4;
+// HPACK static table entry 8, ":status: 200".
+constexpr uint8_t kStatus200 = 0x88;
+
+struct Frame {
+  uint8_t type;
+  uint8_t flags;
+  uint32_t stream_id;
+  std::string payload;
+};
+
+bool ReadFull(int fd, char *buf, std::size_t len) {
+  while (len > 0) {
+    ssize_t n = read(fd, buf, len);
+    if (n <= 0) return false;
+    buf += n;
+    len -= n;
+  }
+  return true;
+}
+
+bool WriteFull(int fd, std::string_view data) {
+  while (!data.empty()) {
+    // Clients may hang up mid-response, which must not raise SIGPIPE.
+    ssize_t n = send(fd, data.data(), data.size(), MSG_NOSIGNAL);
+    if (n <= 0) return false;
+    data.remove_prefix(n);
+  }
+  return true;
+}
+
+bool ReadFrame(int fd, Frame *frame) {
+  unsigned char hdr[9];
+  if (!ReadFull(fd, reinterpret_cast<char*>(hdr), sizeof(hdr))) return false;
+  std::size_t len = (hdr[0] << 16) | (hdr[1] << 8) | hdr[2];
+  frame->type = hdr[3];
+  frame->flags = hdr[4];
+  frame->stream_id =
+      ((hdr[5] & 0x7f) << 24) | (hdr[6] << 16) | (hdr[7] << 8) | hdr[8];
+  frame->payload.resize(len);
+  return ReadFull(fd, frame->payload.data(), len);
+}
+
+bool WriteFrame(int fd, uint8_t type, uint8_t flags, uint32_t stream_id,
+                std::string_view payload) {
+  std::string out(9, '\0');
+  out[0] = static_cast<char>(payload.size() >> 16);
+  out[1] = static_cast<char>(payload.size() >> 8);
+  out[2] = static_cast<char>(payload.size());
+  out[3] = static_cast<char>(type);
+  out[4] = static_cast<char>(flags);
+  out[5] = static_cast<char>(stream_id >> 24);
+  out[6] = static_cast<char>(stream_id >> 16);
+  out[7] = static_cast<char>(stream_id >> 8);
+  out[8] = static_cast<char>(stream_id);
+  out.append(payload.data(), payload.size());
+  return WriteFull(fd, out);
+}
+
+// Reads from fd into *buffer until it holds a complete request head, and
+// returns the head's length including the blank line, or 0 on EOF.
+std::size_t ReadRequestHead(int fd, std::string *buffer) {
+  std::size_t searched = 0;
+  while (true) {
+    auto end = buffer->find("\r\n\r\n", searched);
+    if (end != std::string::npos) return end + 4;
+    searched = buffer->size() < 3 ? 0 : buffer->size() - 3;
+    char chunk[16 << 10];
+    ssize_t n = read(fd, chunk, sizeof(chunk));
+    if (n <= 0) return 0;
+    buffer->append(chunk, n);
+  }
+}
+
+void ServeHTTP1WithDelay(int fd, absl::Duration delay) {
+  std::string buffer;
+  std::string response;
+  while (true) {
+    const std::size_t head_size = ReadRequestHead(fd, &buffer);
+    if (head_size == 0) return;
+    std::string_view head(buffer.data(), head_size);
+
+    std::string_view path = head.substr(0, head.find("\r\n"));
+    path.remove_prefix(std::min(path.size(), path.find(' ') + 1));
+    path = path.substr(0, path.find(' '));
+    path = path.substr(0, path.find('?'));
+    // SimpleAtoi zeroes its output on failure, so it cannot parse straight
+    // into a default.
+    std::size_t requested_size = 0;
+    const bool sized = absl::SimpleAtoi(path.substr(path.rfind('/') + 1),
+                                        &requested_size);
+    const std::size_t body_size =
+        sized ? requested_size : kLoopbackBody.size();
+
+    std::size_t request_body_size = 0;
+    for (std::string_view line : absl::StrSplit(head, "\r\n")) {
+      constexpr std::string_view kContentLength = "content-length:";
+      if (absl::StartsWithIgnoreCase(line, kContentLength)) {
+        if (!absl::SimpleAtoi(line.substr(kContentLength.size()),
+                              &request_body_size)) {
+          return;
+        }
+      }
+    }
+    // Discards the request body, some of which may already be buffered.
+    const std::size_t buffered =
+        std::min(buffer.size() - head_size, request_body_size);
+    buffer.erase(0, head_size + buffered);
+    for (std::size_t remaining = request_body_size - buffered;
+         remaining > 0;) {
+      char chunk[16 << 10];
+      ssize_t n = read(fd, chunk, std::min(sizeof(chunk), remaining));
+      if (n <= 0) return;
+      remaining -= n;
+    }
+
+    response = absl::StrCat("HTTP/1.1 200 OK\r\nContent-Length: ", body_size,
+                            "\r\n\r\n");
+    if (sized) {
+      response.append(body_size, 'x');
+    } else {
+      response.append(kLoopbackBody.data(), kLoopbackBody.size());
+    }
+    if (delay > absl::ZeroDuration()) absl::SleepFor(delay);
+    if (!WriteFull(fd, response)) return;
+  }
+}
+
+}  // namespace
+
+LoopbackServer::LoopbackServer(ServeFunction serve)
+  : serve_(std::move(serve)) {
+  listen_fd_ = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  CHECK(listen_fd_ >= 0);
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  CHECK(bind(listen_fd_, reinterpret_cast<sockaddr*>(&addr),
+             sizeof(addr)) == 0);
+  socklen_t addr_len = sizeof(addr);
+  CHECK(getsockname(listen_fd_, reinterpret_cast<sockaddr*>(&addr),
+                    &addr_len) == 0);
+  port_ = ntohs(addr.sin_port);
+  Listen();
+}
+
+LoopbackServer::LoopbackServer(ServeFunction serve, std::string unix_path)
+  : serve_(std::move(serve)), unix_path_(std::move(unix_path)) {
+  listen_fd_ = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  CHECK(listen_fd_ >= 0);
+  sockaddr_un addr{};
+  addr.sun_family = AF_UNIX;
+  CHECK(unix_path_.size() < sizeof(addr.sun_path));
+  unix_path_.copy(addr.sun_path, unix_path_.size());
+  CHECK(bind(listen_fd_, reinterpret_cast<sockaddr*>(&addr),
+             sizeof(addr)) == 0);
+  Listen();
+}
+
+void LoopbackServer::Listen() {
+  CHECK(listen(listen_fd_, SOMAXCONN) == 0);
+  accept_thread_ = std::thread([this]() { AcceptLoop(); });
+}
+
+LoopbackServer::~LoopbackServer() {
+  shutdown(listen_fd_, SHUT_RDWR);
+  accept_thread_.join();
+  close(listen_fd_);
+  if (!unix_path_.empty()) unlink(unix_path_.c_str());
+  absl::MutexLock lock(&mu_);
+  for (Connection &conn : conns_) shutdown(conn.fd, SHUT_RDWR);
+  // Connections finishing now need mu_ to say so.
+  mu_.Await(absl::Condition(
+      +[](std::list<Connection> *conns) {
+        return std::all_of(conns->begin(), conns->end(),
+                           [](const Connection &conn) { return conn.done; });
+      },
+      &conns_));
+  ReapLocked();
+}
+
+std::string LoopbackServer::URL(std::string_view path) const {
+  if (!unix_path_.empty()) return absl::StrCat("http://localhost", path);
+  return absl::StrCat("http://127.0.0.1:", port_, path);
+}
+
+uint16_t LoopbackServer::port() const { return port_; }
+
+const std::string &LoopbackServer::unix_path() const { return unix_path_; }
+
+int LoopbackServer::connections() const { return connections_.load(); }
+
+void LoopbackServer::AcceptLoop() {
+  while (true) {
+    int fd = accept4(listen_fd_, nullptr, nullptr, SOCK_CLOEXEC);
+    if (fd < 0) return;
+    ++connections_;
+    absl::MutexLock lock(&mu_);
+    ReapLocked();
+    // Shutting down the socket is what stops serve_, so fd is closed only
+    // after joining.
+    Connection &conn = conns_.emplace_back();
+    conn.fd = fd;
+    conn.thread = std::thread([this, fd, &conn]() {
+      serve_(fd);
+      absl::MutexLock lock(&mu_);
+      conn.done = true;
+    });
+  }
+}
+
+void LoopbackServer::ReapLocked() {
+  for (auto it = conns_.begin(); it != conns_.end();) {
+    if (!it->done) {
+      ++it;
+      continue;
+    }
+    // The thread has nothing left to do but exit.
+    it->thread.join();
+    close(it->fd);
+    it = conns_.erase(it);
+  }
+}
+
+void ServeHTTP1(int fd) { ServeHTTP1WithDelay(fd, absl::ZeroDuration()); }
+
+LoopbackServer::ServeFunction DelayedHTTP1(absl::Duration delay) {
+  return [delay](int fd) { ServeHTTP1WithDelay(fd, delay); };
+}
+
+void ServeH2C(int fd) {
+  std::string preface(kPreface.size(), '\0');
+  if (!ReadFull(fd, preface.data(), preface.size())) return;
+  if (preface != kPreface) return;
+  if (!WriteFrame(fd, kSettings, 0, 0, {})) return;
+
+  Frame frame;
+  bool headers_end_stream = false;
+  while (ReadFrame(fd, &frame)) {
+    bool respond = false;
+    switch (frame.type) {
+      case kSettings:
+        if (!(frame.flags & kAck) &&
+            !WriteFrame(fd, kSettings, kAck, 0, {})) {
+          return;
+        }
+        break;
+      case kPing:
+        if (!(frame.flags & kAck) &&
+            !WriteFrame(fd, kPing, kAck, 0, frame.payload)) {
+          return;
+        }
+        break;
+      case kHeaders:
+      case kContinuation:
+        if (frame.type == kHeaders) {
+          headers_end_stream = frame.flags & kEndStream;
+        }
+        respond = (frame.flags & kEndHeaders) && headers_end_stream;
+        break;
+      case kData:
+        respond = frame.flags & kEndStream;
+        break;
+      case kGoAway:
+        return;
+      default:
+        break;
+    }
+    if (!respond) continue;
+    const char status[] = {static_cast<char>(kStatus200)};
+    if (!WriteFrame(fd, kHeaders, kEndHeaders, frame.stream_id,
+                    {status, sizeof(status)}) ||
+        !WriteFrame(fd, kData, kEndStream, frame.stream_id, kLoopbackBody)) {
+      return;
+    }
+  }
+}
+
+}  // namespace rhutil
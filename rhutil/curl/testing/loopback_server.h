@@ -0,0 +1,87 @@
+#ifndef RHUTIL_CURL_TESTING_LOOPBACK_SERVER_H_
+#define RHUTIL_CURL_TESTING_LOOPBACK_SERVER_H_
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <string>
+#include <string_view>
+#include <thread>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/time/time.h"
+
+namespace rhutil {
+
+// The body the loopback servers answer with unless asked for another size.
+constexpr std::string_view kLoopbackBody = "hello over loopback";
+
+// Listens on an ephemeral port on 127.0.0.1, serving each connection on its
+// own thread until the client hangs up or the server is destroyed.
+class LoopbackServer {
+ public:
+  // Called with each accepted connection. The server closes fd once serve
+  // returns.
+  using ServeFunction = std::function<void(int fd)>;
+
+  explicit LoopbackServer(ServeFunction serve);
+  // Listens on a Unix domain socket at unix_path instead, which must not
+  // exist yet. The destructor removes it.
+  LoopbackServer(ServeFunction serve, std::string unix_path);
+  ~LoopbackServer();
+
+  LoopbackServer(const LoopbackServer &) = delete;
+  LoopbackServer &operator=(const LoopbackServer &) = delete;
+
+  // For Unix domain sockets the URL's host is localhost.
+  std::string URL(std::string_view path = "/") const;
+  // 0 for Unix domain sockets.
+  uint16_t port() const;
+  // Empty unless listening on a Unix domain socket.
+  const std::string &unix_path() const;
+  // The number of connections accepted so far.
+  int connections() const;
+
+ private:
+  struct Connection {
+    int fd;
+    std::thread thread;
+    // Set once serve_ has returned.
+    bool done = false;
+  };
+
+  void Listen();
+  void AcceptLoop();
+  // Joins and closes connections whose serve_ has returned, so that
+  // benchmarks making many short connections do not run out of fds.
+  void ReapLocked() EXCLUSIVE_LOCKS_REQUIRED(mu_);
+
+  const ServeFunction serve_;
+  const std::string unix_path_;
+  int listen_fd_;
+  uint16_t port_ = 0;
+  std::atomic<int> connections_{0};
+  std::thread accept_thread_;
+  absl::Mutex mu_;
+  std::list<Connection> conns_ GUARDED_BY(mu_);
+};
+
+// Serves HTTP/1.1 with keep-alive. Every request is answered with a 200. If
+// the last path component is a number (e.g. "/bytes/4096") the body is that
+// many bytes, and otherwise it is kLoopbackBody. Request bodies must have a
+// Content-Length, and are discarded.
+void ServeHTTP1(int fd);
+
+// ServeHTTP1, but waiting delay before each response, to stand in for a
+// remote server's round trip.
+LoopbackServer::ServeFunction DelayedHTTP1(absl::Duration delay);
+
+// Serves h2c (cleartext HTTP/2 with prior knowledge). Every request stream is
+// answered with a 200 and kLoopbackBody, without decoding request headers.
+void ServeH2C(int fd);
+
+}  // namespace rhutil
+
+#endif  // RHUTIL_CURL_TESTING_LOOPBACK_SERVER_H_
@@ -0,0 +1,124 @@
+#include "rhutil/curl/transfer_stats.h"
+
+#include <algorithm>
+#include <cmath>
+#include <utility>
+#include <vector>
+
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_format.h"
+
+namespace rhutil {
+
+void LatencyHistogram::Record(absl::Duration latency) {
+  int64_t micros = std::max<int64_t>(absl::ToInt64Microseconds(latency), 0);
+  std::size_t bucket = 0;
+  while (micros > 1 && bucket + 1 < kBuckets) {
+    micros >>= 1;
+    ++bucket;
+  }
+  ++buckets_[bucket];
+  ++count_;
+  sum_ += latency;
+}
+
+void LatencyHistogram::Merge(const LatencyHistogram &other) {
+  for (std::size_t i = 0; i < kBuckets; ++i) buckets_[i] += other.buckets_[i];
+  count_ += other.count_;
+  sum_ += other.sum_;
+}
+
+uint64_t LatencyHistogram::count() const { return count_; }
+
+absl::Duration LatencyHistogram::sum() const { return sum_; }
+
+uint64_t LatencyHistogram::bucket(std::size_t i) const {
+  CHECK(i < kBuckets);
+  return buckets_[i];
+}
+
+absl::Duration LatencyHistogram::BucketUpperBound(std::size_t i) {
+  return absl::Microseconds(int64_t{1} << (i + 1));
+}
+
+absl::Duration LatencyHistogram::Percentile(double percentile) const {
+  if (count_ == 0) return absl::ZeroDuration();
+  uint64_t rank = static_cast<uint64_t>(
+      std::ceil(std::clamp(percentile, 0.0, 100.0) / 100 * count_));
+  rank = std::max<uint64_t>(rank, 1);
+  uint64_t seen = 0;
+  for (std::size_t i = 0; i < kBuckets; ++i) {
+    seen += buckets_[i];
+    if (seen >= rank) return BucketUpperBound(i);
+  }
+  return BucketUpperBound(kBuckets - 1);
+}
+
+void TransferStatsRecorder::Record(std::string_view host,
+                                   const TransferStats &stats) {
+  absl::MutexLock lock(&mu_);
+  auto it = hosts_.find(host);
+  if (it == hosts_.end()) it = hosts_.emplace(host, HostStats()).first;
+  HostStats &h = it->second;
+  ++h.transfers;
+  if (stats.connection_reused) {
+    ++h.reused_connections;
+  } else {
+    h.dns.Record(stats.DNSTime());
+    h.connect.Record(stats.ConnectTime());
+    if (stats.app_connect != absl::ZeroDuration()) {
+      h.tls.Record(stats.TLSTime());
+    }
+  }
+  h.redirects += stats.redirect_count;
+  h.bytes_downloaded += stats.bytes_downloaded;
+  h.bytes_uploaded += stats.bytes_uploaded;
+  h.first_byte.Record(stats.FirstByteTime());
+  h.body.Record(stats.BodyTime());
+  h.total.Record(stats.total);
+}
+
+absl::flat_hash_map<std::string, TransferStatsRecorder::HostStats>
+TransferStatsRecorder::Snapshot() const {
+  absl::MutexLock lock(&mu_);
+  return hosts_;
+}
+
+std::string TransferStatsRecorder::ToString() const {
+  auto snapshot = Snapshot();
+  std::vector<std::string> hosts;
+  for (const auto &entry : snapshot) hosts.push_back(entry.first);
+  std::sort(hosts.begin(), hosts.end());
+
+  std::string out;
+  for (const std::string &host : hosts) {
+    const HostStats &h = snapshot[host];
+    absl::StrAppend(&out, host, " transfers=", h.transfers,
+                    " reused_connections=", h.reused_connections,
+                    " redirects=", h.redirects,
+                    " bytes_downloaded=", h.bytes_downloaded,
+                    " bytes_uploaded=", h.bytes_uploaded, "\n");
+    std::pair<const char *, const LatencyHistogram *> phases[] = {
+      {"dns", &h.dns},
+      {"connect", &h.connect},
+      {"tls", &h.tls},
+      {"first_byte", &h.first_byte},
+      {"body", &h.body},
+      {"total", &h.total},
+    };
+    for (const auto &phase : phases) {
+      const LatencyHistogram &hist = *phase.second;
+      if (hist.count() == 0) continue;
+      absl::StrAppendFormat(
+          &out, "%s %s count=%d p50=%s p90=%s p99=%s p99.9=%s\n", host,
+          phase.first, hist.count(),
+          absl::FormatDuration(hist.Percentile(50)),
+          absl::FormatDuration(hist.Percentile(90)),
+          absl::FormatDuration(hist.Percentile(99)),
+          absl::FormatDuration(hist.Percentile(99.9)));
+    }
+  }
+  return out;
+}
+
+}  // namespace rhutil
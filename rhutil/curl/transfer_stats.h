@@ -0,0 +1,78 @@
+#ifndef RHUTIL_CURL_TRANSFER_STATS_H_
+#define RHUTIL_CURL_TRANSFER_STATS_H_
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+#include "rhutil/curl/curl.h"
+#include "absl/time/time.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/container/flat_hash_map.h"
+
+namespace rhutil {
+
+// A latency histogram with power-of-two microsecond buckets. Not thread-safe.
+class LatencyHistogram {
+ public:
+  static constexpr std::size_t kBuckets = 32;
+
+  void Record(absl::Duration latency);
+  void Merge(const LatencyHistogram &other);
+
+  uint64_t count() const;
+  absl::Duration sum() const;
+  // Returns the upper bound of the bucket containing the given percentile
+  // (in [0, 100]), or zero if the histogram is empty.
+  absl::Duration Percentile(double percentile) const;
+
+  // bucket(i) counts latencies in [2^i, 2^(i+1)) microseconds. bucket(0) also
+  // counts latencies under one microsecond.
+  uint64_t bucket(std::size_t i) const;
+  static absl::Duration BucketUpperBound(std::size_t i);
+
+ private:
+  std::array<uint64_t, kBuckets> buckets_{};
+  uint64_t count_ = 0;
+  absl::Duration sum_;
+};
+
+// Thread-safe per-host aggregation of TransferStats.
+class TransferStatsRecorder {
+ public:
+  struct HostStats {
+    uint64_t transfers = 0;
+    uint64_t reused_connections = 0;
+    uint64_t redirects = 0;
+    int64_t bytes_downloaded = 0;
+    int64_t bytes_uploaded = 0;
+    LatencyHistogram dns;
+    LatencyHistogram connect;
+    LatencyHistogram tls;
+    LatencyHistogram first_byte;
+    LatencyHistogram body;
+    LatencyHistogram total;
+  };
+
+  TransferStatsRecorder() = default;
+  TransferStatsRecorder(const TransferStatsRecorder &) = delete;
+  TransferStatsRecorder &operator=(const TransferStatsRecorder &) = delete;
+
+  void Record(std::string_view host, const TransferStats &stats);
+
+  absl::flat_hash_map<std::string, HostStats> Snapshot() const;
+
+  // Renders a line per host and phase, suitable for a debug or scrape
+  // endpoint.
+  std::string ToString() const;
+
+ private:
+  mutable absl::Mutex mu_;
+  absl::flat_hash_map<std::string, HostStats> hosts_ GUARDED_BY(mu_);
+};
+
+}  // namespace rhutil
+
+#endif  // RHUTIL_CURL_TRANSFER_STATS_H_
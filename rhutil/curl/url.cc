@@ -0,0 +1,209 @@
+#include "rhutil/curl/url.h"
+
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <utility>
+
+#include "absl/strings/ascii.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/strip.h"
+
+namespace rhutil {
+namespace {
+
+bool IsUnreserved(char c) {
+  return absl::ascii_isalnum(c) || c == '-' || c == '.' || c == '_' ||
+      c == '~';
+}
+
+}  // namespace
+
+StatusOr<ParsedURL> ParsedURL::Parse(std::string_view url) {
+  // CurlURL requires a null-terminated string.
+  ASSIGN_OR_RETURN(CurlURL curl_url, CurlURL::FromString(std::string(url)));
+  return FromCurlURL(curl_url);
+}
+
+StatusOr<ParsedURL> ParsedURL::FromCurlURL(const CurlURL &url) {
+  ParsedURL parsed;
+  RETURN_IF_ERROR(parsed.Append(url, CURLUPART_URL, CURLUE_OK, 0,
+                                &parsed.url_));
+  RETURN_IF_ERROR(parsed.Append(url, CURLUPART_SCHEME, CURLUE_OK,
+                                CURLU_DEFAULT_SCHEME, &parsed.scheme_));
+  RETURN_IF_ERROR(parsed.Append(url, CURLUPART_USER, CURLUE_NO_USER,
+                                CURLU_URLDECODE, &parsed.user_));
+  RETURN_IF_ERROR(parsed.Append(url, CURLUPART_PASSWORD, CURLUE_NO_PASSWORD,
+                                CURLU_URLDECODE, &parsed.password_));
+  RETURN_IF_ERROR(parsed.Append(url, CURLUPART_HOST, CURLUE_NO_HOST,
+                                CURLU_URLDECODE, &parsed.host_));
+  RETURN_IF_ERROR(parsed.Append(url, CURLUPART_PATH, CURLUE_OK, 0,
+                                &parsed.path_));
+  RETURN_IF_ERROR(parsed.Append(url, CURLUPART_QUERY, CURLUE_NO_QUERY, 0,
+                                &parsed.query_));
+  RETURN_IF_ERROR(parsed.Append(url, CURLUPART_FRAGMENT, CURLUE_NO_FRAGMENT,
+                                0, &parsed.fragment_));
+
+  Part port;
+  RETURN_IF_ERROR(parsed.Append(url, CURLUPART_PORT, CURLUE_NO_PORT,
+                                CURLU_DEFAULT_PORT, &port));
+  uint32_t port_number = 0;  // SimpleAtoi doesn't work with 16-bit numbers.
+  if (port.size != 0 &&
+      !absl::SimpleAtoi(parsed.Get(port), &port_number)) {
+    return InvalidArgumentErrorBuilder() << "Bad port in " << parsed.url();
+  }
+  parsed.port_ = port_number;
+  return parsed;
+}
+
+Status ParsedURL::Append(const CurlURL &url, CURLUPart which,
+                         CURLUcode absent, unsigned int flags, Part *part) {
+  std::unique_ptr<char, CurlStrDeleter> value;
+  if (absent == CURLUE_OK) {
+    ASSIGN_OR_RETURN(value, url.Get(which, flags));
+  } else {
+    ASSIGN_OR_RETURN(value, url.GetAndMapErrorToNull(which, absent, flags));
+  }
+  std::string_view str = value ? value.get() : "";
+  part->offset = buffer_.size();
+  part->size = str.size();
+  buffer_.append(str.data(), str.size());
+  buffer_.push_back('\0');
+  return OkStatus();
+}
+
+std::string_view ParsedURL::Get(Part part) const {
+  if (buffer_.empty()) return {};
+  return {buffer_.data() + part.offset, part.size};
+}
+
+std::string_view ParsedURL::url() const { return Get(url_); }
+const char *ParsedURL::c_str() const { return url().data(); }
+std::string_view ParsedURL::scheme() const { return Get(scheme_); }
+std::string_view ParsedURL::user() const { return Get(user_); }
+std::string_view ParsedURL::password() const { return Get(password_); }
+std::string_view ParsedURL::host() const { return Get(host_); }
+uint16_t ParsedURL::port() const { return port_; }
+std::string_view ParsedURL::path() const { return Get(path_); }
+std::string_view ParsedURL::query() const { return Get(query_); }
+std::string_view ParsedURL::fragment() const { return Get(fragment_); }
+
+StatusOr<CurlURL> ParsedURL::ToCurlURL() const {
+  return CurlURL::FromString(url());
+}
+
+StatusOr<URLTemplate> URLTemplate::Parse(std::string_view pattern) {
+  URLTemplate tmpl;
+  std::string literal;
+  for (std::size_t i = 0; i < pattern.size(); ++i) {
+    const char c = pattern[i];
+    if (c == '}') {
+      return InvalidArgumentErrorBuilder()
+          << "Unmatched '}' at offset " << i << " of " << pattern;
+    } else if (c != '{') {
+      literal.push_back(c);
+      continue;
+    }
+    const std::size_t end = pattern.find_first_of("{}", i + 1);
+    if (end == std::string_view::npos || pattern[end] != '}') {
+      return InvalidArgumentErrorBuilder()
+          << "Unterminated '{' at offset " << i << " of " << pattern;
+    }
+    std::string_view name = pattern.substr(i + 1, end - i - 1);
+    if (name.empty()) {
+      return InvalidArgumentErrorBuilder()
+          << "Empty placeholder at offset " << i << " of " << pattern;
+    }
+    tmpl.literals_size_ += literal.size();
+    tmpl.literals_.push_back(std::move(literal));
+    literal.clear();
+    tmpl.variables_.emplace_back(name);
+    i = end;
+  }
+  tmpl.literals_size_ += literal.size();
+  tmpl.literals_.push_back(std::move(literal));
+
+  std::vector<std::string_view> values(tmpl.variables_.size(), "x");
+  std::string example;
+  RETURN_IF_ERROR(tmpl.Expand(values, &example));
+  RETURN_IF_ERROR(CurlURL::FromString(example).status())
+      << "; invalid URL template " << pattern;
+  return tmpl;
+}
+
+const std::vector<std::string> &URLTemplate::variables() const {
+  return variables_;
+}
+
+Status URLTemplate::Expand(absl::Span<const std::string_view> values,
+                           std::string *out) const {
+  if (values.size() != variables_.size()) {
+    return InvalidArgumentErrorBuilder()
+        << "URL template takes " << variables_.size() << " values, but "
+        << values.size() << " were given";
+  }
+  std::size_t size = literals_size_;
+  for (std::string_view value : values) size += value.size() * 3;
+  out->clear();
+  // In C++17 a smaller reserve may shrink the buffer.
+  if (size > out->capacity()) out->reserve(size);
+  for (std::size_t i = 0; i < values.size(); ++i) {
+    out->append(literals_[i]);
+    AppendURLEscaped(values[i], out);
+  }
+  if (!literals_.empty()) out->append(literals_.back());
+  return OkStatus();
+}
+
+StatusOr<UnixSocketURL> UnixSocketURL::Parse(std::string_view url) {
+  const auto separator = url.find("://");
+  if (separator == std::string_view::npos) {
+    return InvalidArgumentErrorBuilder() << "Not a URL: " << url;
+  }
+  UnixSocketURL ret;
+  std::string_view scheme = url.substr(0, separator);
+  if (absl::ConsumeSuffix(&scheme, "+unix-abstract")) {
+    ret.socket.abstract = true;
+  } else if (!absl::ConsumeSuffix(&scheme, "+unix")) {
+    return InvalidArgumentErrorBuilder()
+        << "Scheme must end in +unix or +unix-abstract: " << url;
+  }
+
+  std::string_view rest = url.substr(separator + 3);
+  const auto authority_end = std::min(rest.find_first_of("/?#"), rest.size());
+  std::string_view authority = rest.substr(0, authority_end);
+  // curl_easy_unescape takes a length of zero to mean strlen.
+  if (authority.empty()) {
+    return InvalidArgumentErrorBuilder() << "URL names no socket: " << url;
+  }
+  int decoded_size = 0;
+  std::unique_ptr<char, CurlStrDeleter> decoded(curl_easy_unescape(
+      nullptr, authority.data(), authority.size(), &decoded_size));
+  if (!decoded) return InternalError("curl_easy_unescape failed");
+  if (decoded_size == 0 || std::memchr(decoded.get(), '\0', decoded_size)) {
+    return InvalidArgumentErrorBuilder()
+        << "URL does not name a valid socket: " << url;
+  }
+  ret.socket.path.assign(decoded.get(), decoded_size);
+
+  ASSIGN_OR_RETURN(ret.url, CurlURL::FromString(absl::StrCat(
+      scheme, "://localhost", rest.substr(authority_end))));
+  return ret;
+}
+
+void AppendURLEscaped(std::string_view value, std::string *out) {
+  static constexpr char kHex[] = "0123456789ABCDEF";
+  for (char c : value) {
+    if (IsUnreserved(c)) {
+      out->push_back(c);
+    } else {
+      const auto byte = static_cast<unsigned char>(c);
+      out->push_back('%');
+      out->push_back(kHex[byte >> 4]);
+      out->push_back(kHex[byte & 0xf]);
+    }
+  }
+}
+
+}  // namespace rhutil
@@ -0,0 +1,123 @@
+#ifndef RHUTIL_CURL_URL_H_
+#define RHUTIL_CURL_URL_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "rhutil/status.h"
+#include "rhutil/curl/curl.h"
+#include "absl/types/span.h"
+
+namespace rhutil {
+
+// A URL parsed once by libcurl, whose components are then available as
+// string_views without any further calls into libcurl or allocations. All the
+// views are null-terminated, point into the ParsedURL and are valid for as
+// long as it is.
+//
+// user, password and host are decoded as by CurlURL. path, query and fragment
+// are percent-encoded, as they appear in url(). Absent components are empty.
+class ParsedURL {
+ public:
+  ParsedURL() = default;
+
+  static StatusOr<ParsedURL> Parse(std::string_view url);
+  static StatusOr<ParsedURL> FromCurlURL(const CurlURL &url);
+
+  // The normalized URL, suitable for CURLOPT_URL.
+  std::string_view url() const;
+  const char *c_str() const;
+
+  std::string_view scheme() const;
+  std::string_view user() const;
+  std::string_view password() const;
+  std::string_view host() const;
+  // The explicit port, or the scheme's default.
+  uint16_t port() const;
+  std::string_view path() const;
+  // Without the leading '?'.
+  std::string_view query() const;
+  std::string_view fragment() const;
+
+  StatusOr<CurlURL> ToCurlURL() const;
+
+ private:
+  // Offsets rather than views, so that copies need no fixing up.
+  struct Part {
+    uint32_t offset = 0;
+    uint32_t size = 0;
+  };
+
+  std::string_view Get(Part part) const;
+  Status Append(const CurlURL &url, CURLUPart which, CURLUcode absent,
+                unsigned int flags, Part *part);
+
+  // Every component, each followed by a NUL.
+  std::string buffer_;
+  Part url_;
+  Part scheme_;
+  Part user_;
+  Part password_;
+  Part host_;
+  Part path_;
+  Part query_;
+  Part fragment_;
+  uint16_t port_ = 0;
+};
+
+// A URL with {name} placeholders, such as
+//
+//   https://api.example.com/v1/users/{user}/posts?limit={limit}
+//
+// which is parsed once and then expanded for every request. Values are
+// percent-encoded, leaving only unreserved characters (RFC 3986) as is.
+class URLTemplate {
+ public:
+  URLTemplate() = default;
+
+  // Fails if the pattern has unbalanced braces, an empty placeholder name, or
+  // is not a valid URL once its placeholders are filled in.
+  static StatusOr<URLTemplate> Parse(std::string_view pattern);
+
+  // In the order they appear in the pattern. A name used more than once
+  // appears more than once.
+  const std::vector<std::string> &variables() const;
+
+  // Replaces the contents of *out with the pattern, filled in with values in
+  // the order of variables(). Callers should reuse *out between requests:
+  // once it has grown to fit, expanding no longer allocates. out->c_str() can
+  // be passed to CURLOPT_URL.
+  Status Expand(absl::Span<const std::string_view> values,
+                std::string *out) const;
+
+ private:
+  // One more literal than there are variables.
+  std::vector<std::string> literals_;
+  std::vector<std::string> variables_;
+  std::size_t literals_size_ = 0;
+};
+
+// A URL which names a Unix domain socket as its host, such as
+//
+//   http+unix://%2Frun%2Fsidecar.sock/v1/status
+//   https+unix-abstract://sidecar/v1/status
+//
+// split into the socket and the equivalent http(s) URL for localhost, for
+// CurlEasySetUnixSocket and CURLOPT_URL respectively.
+struct UnixSocketURL {
+  CurlUnixSocket socket;
+  CurlURL url;
+
+  // The socket path is percent-decoded.
+  static StatusOr<UnixSocketURL> Parse(std::string_view url);
+};
+
+// Appends value to *out, percent-encoding all but unreserved characters.
+void AppendURLEscaped(std::string_view value, std::string *out);
+
+}  // namespace rhutil
+
+#endif  // RHUTIL_CURL_URL_H_
@@ -0,0 +1,218 @@
+#include "rhutil/curl/warmup.h"
+
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include <algorithm>
+#include <memory>
+
+#include "rhutil/errno.h"
+#include "rhutil/file.h"
+#include "rhutil/curl/multi.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_join.h"
+#include "absl/strings/str_split.h"
+#include "absl/time/clock.h"
+
+namespace rhutil {
+
+std::string ResolvedHost::ResolveEntry() const {
+  return absl::StrCat(host, ":", port, ":", absl::StrJoin(addresses, ","));
+}
+
+StatusOr<ResolvedHost> ResolveHost(std::string_view host, uint16_t port) {
+  ResolvedHost resolved;
+  resolved.host = std::string(host);
+  resolved.port = port;
+
+  addrinfo hints = {};
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  addrinfo *result = nullptr;
+  int rc = getaddrinfo(resolved.host.c_str(), nullptr, &hints, &result);
+  if (rc == EAI_SYSTEM) {
+    return StatusBuilder(ErrnoAsStatus()) << "Failed to resolve " << host;
+  } else if (rc != 0) {
+    return StatusBuilder(UnavailableError("Failed to resolve "))
+        << host << ": " << gai_strerror(rc);
+  }
+  std::unique_ptr<addrinfo, void(*)(addrinfo*)> cleanup(result, &freeaddrinfo);
+  resolved.resolved_at = absl::Now();
+
+  for (addrinfo *ai = result; ai != nullptr; ai = ai->ai_next) {
+    char buf[INET6_ADDRSTRLEN];
+    std::string address;
+    if (ai->ai_family == AF_INET) {
+      auto *addr = reinterpret_cast<sockaddr_in*>(ai->ai_addr);
+      if (inet_ntop(AF_INET, &addr->sin_addr, buf, sizeof(buf)) == nullptr) {
+        return ErrnoAsStatus();
+      }
+      address = buf;
+    } else if (ai->ai_family == AF_INET6) {
+      auto *addr = reinterpret_cast<sockaddr_in6*>(ai->ai_addr);
+      if (inet_ntop(AF_INET6, &addr->sin6_addr, buf, sizeof(buf)) == nullptr) {
+        return ErrnoAsStatus();
+      }
+      address = absl::StrCat("[", buf, "]");
+    } else {
+      continue;
+    }
+    auto &addresses = resolved.addresses;
+    if (std::find(addresses.begin(), addresses.end(), address) ==
+        addresses.end()) {
+      addresses.push_back(std::move(address));
+    }
+  }
+  if (resolved.addresses.empty()) {
+    return NotFoundErrorBuilder() << "No addresses for " << host;
+  }
+  return resolved;
+}
+
+Status SaveDNSSnapshot(std::string_view path,
+                       absl::Span<const ResolvedHost> hosts) {
+  std::string data;
+  for (const ResolvedHost &host : hosts) {
+    absl::StrAppend(&data, host.host, " ", host.port, " ",
+                    absl::ToUnixMicros(host.resolved_at), " ",
+                    absl::StrJoin(host.addresses, ","), "\n");
+  }
+  return WriteFileAtomically(path, data);
+}
+
+StatusOr<std::vector<ResolvedHost>> LoadDNSSnapshot(std::string_view path) {
+  ASSIGN_OR_RETURN(std::string data, ReadFileToString(path));
+  std::vector<ResolvedHost> hosts;
+  for (std::string_view line : absl::StrSplit(data, '\n', absl::SkipEmpty())) {
+    std::vector<std::string_view> fields = absl::StrSplit(line, ' ');
+    ResolvedHost host;
+    uint32_t port;
+    int64_t resolved_micros;
+    if (fields.size() != 4 || !absl::SimpleAtoi(fields[1], &port) ||
+        port > UINT16_MAX || !absl::SimpleAtoi(fields[2], &resolved_micros)) {
+      return StatusBuilder(DataLossError("Malformed DNS snapshot line "))
+          << "\"" << line << "\" in " << path;
+    }
+    host.host = std::string(fields[0]);
+    host.port = port;
+    host.resolved_at = absl::FromUnixMicros(resolved_micros);
+    host.addresses = absl::StrSplit(fields[3], ',', absl::SkipEmpty());
+    hosts.push_back(std::move(host));
+  }
+  return hosts;
+}
+
+ShareWarmer::ShareWarmer(const ThreadSafeCurlShare *share, Options options)
+  : share_(share), options_(std::move(options)) {}
+
+Status ShareWarmer::Warm() {
+  std::vector<ResolvedHost> snapshot;
+  if (!options_.snapshot_path.empty()) {
+    // A missing or unreadable snapshot only means starting cold.
+    auto loaded = LoadDNSSnapshot(options_.snapshot_path);
+    if (loaded.ok()) snapshot = std::move(loaded).ValueOrDie();
+  }
+
+  const absl::Time now = absl::Now();
+  Status status;
+  std::vector<std::pair<std::string, std::string>> targets;
+  seeded_.clear();
+  for (const CurlURL &url : options_.urls) {
+    auto host = url.GetHost();
+    if (!host) {
+      status.Update(InvalidArgumentError("URL to warm has no host"));
+      continue;
+    }
+    const uint16_t port = url.GetPort();
+    auto cached = std::find_if(
+        snapshot.begin(), snapshot.end(), [&](const ResolvedHost &h) {
+          return h.host == host.get() && h.port == port &&
+              now - h.resolved_at < options_.dns_ttl;
+        });
+    ResolvedHost resolved;
+    if (cached != snapshot.end()) {
+      resolved = *cached;
+    } else {
+      auto resolved_or = ResolveHost(host.get(), port);
+      if (!resolved_or.ok()) {
+        status.Update(resolved_or.status());
+        continue;
+      }
+      resolved = std::move(resolved_or).ValueOrDie();
+    }
+    targets.emplace_back(url.GetURL().get(), resolved.ResolveEntry());
+    seeded_.push_back(std::move(resolved));
+  }
+  status.Update(Connect(targets));
+  if (!options_.snapshot_path.empty()) {
+    status.Update(SaveDNSSnapshot(options_.snapshot_path, seeded_));
+  }
+  return status;
+}
+
+Status ShareWarmer::Refresh(absl::Time now) {
+  std::vector<std::pair<std::string, std::string>> targets;
+  std::vector<ResolvedHost> kept;
+  for (ResolvedHost &resolved : seeded_) {
+    if (now - resolved.resolved_at < options_.dns_ttl) {
+      kept.push_back(std::move(resolved));
+      continue;
+    }
+    for (const CurlURL &url : options_.urls) {
+      auto host = url.GetHost();
+      if (host && resolved.host == host.get() &&
+          resolved.port == url.GetPort()) {
+        targets.emplace_back(
+            url.GetURL().get(),
+            absl::StrCat("-", resolved.host, ":", resolved.port));
+        break;
+      }
+    }
+  }
+  seeded_ = std::move(kept);
+  return Connect(targets);
+}
+
+const std::vector<ResolvedHost> &ShareWarmer::seeded() const {
+  return seeded_;
+}
+
+Status ShareWarmer::Connect(
+    absl::Span<const std::pair<std::string, std::string>> targets) {
+  CurlMulti multi;
+  Status status;
+  // libcurl applies CURLOPT_RESOLVE (to the share's DNS cache) when the
+  // transfer starts, so the lists must outlive the transfers.
+  std::vector<std::unique_ptr<curl_slist, CurlSListDeleter>> resolve_lists;
+  for (const auto &target : targets) {
+    const std::string &url = target.first;
+    std::string_view entry = target.second;
+    resolve_lists.push_back(NewCurlSList({&entry, 1}));
+
+    auto handle = CurlEasyInit();
+    RETURN_IF_ERROR(CurlEasySetopt(handle.get(), CURLOPT_URL, url.c_str()));
+    RETURN_IF_ERROR(CurlEasySetopt(handle.get(), CURLOPT_SHARE, share_->ptr()));
+    RETURN_IF_ERROR(CurlEasySetopt(handle.get(), CURLOPT_CONNECT_ONLY, 1L));
+    RETURN_IF_ERROR(CurlEasySetopt(
+        handle.get(), CURLOPT_CONNECTTIMEOUT_MS,
+        static_cast<long>(absl::ToInt64Milliseconds(
+            options_.connect_timeout))));
+    RETURN_IF_ERROR(CurlEasySetopt(handle.get(), CURLOPT_RESOLVE,
+                                   resolve_lists.back().get()));
+    RETURN_IF_ERROR(multi.Add(
+        std::move(handle),
+        [&status, url](std::unique_ptr<CURL, CurlHandleDeleter>, Status st) {
+          if (!st.ok()) {
+            status.Update(StatusBuilder(std::move(st))
+                          << "; failed to connect to " << url);
+          }
+        }));
+  }
+  RETURN_IF_ERROR(multi.Run());
+  return status;
+}
+
+}  // namespace rhutil
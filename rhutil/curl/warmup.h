@@ -0,0 +1,93 @@
+#ifndef RHUTIL_CURL_WARMUP_H_
+#define RHUTIL_CURL_WARMUP_H_
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "rhutil/status.h"
+#include "rhutil/curl/curl.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "absl/types/span.h"
+
+namespace rhutil {
+
+struct ResolvedHost {
+  std::string host;
+  uint16_t port = 0;
+  // Numeric addresses, IPv6 ones in brackets.
+  std::vector<std::string> addresses;
+  absl::Time resolved_at;
+
+  // Returns the entry in the host:port:address[,address]... form of
+  // CURLOPT_RESOLVE.
+  std::string ResolveEntry() const;
+};
+
+// Resolves host with getaddrinfo.
+StatusOr<ResolvedHost> ResolveHost(std::string_view host, uint16_t port);
+
+Status SaveDNSSnapshot(std::string_view path,
+                       absl::Span<const ResolvedHost> hosts);
+StatusOr<std::vector<ResolvedHost>> LoadDNSSnapshot(std::string_view path);
+
+// Warms a share's DNS and TLS session caches for a fixed list of hosts, so
+// that a freshly started process does not pay for DNS lookups and full TLS
+// handshakes on its first requests. Not thread-safe.
+//
+// libcurl has no API to export its DNS cache or TLS sessions, so the
+// addresses this class resolves are what gets persisted; TLS sessions are
+// re-established by connecting to every host ahead of time.
+class ShareWarmer {
+ public:
+  struct Options {
+    // scheme://host:port of each host to warm.
+    std::vector<CurlURL> urls;
+    // Addresses older than this are neither loaded from the snapshot nor
+    // kept in the share.
+    absl::Duration dns_ttl = absl::Minutes(5);
+    // If set, Warm reads unexpired addresses from this file instead of
+    // resolving them, and writes the addresses it used back to it.
+    std::string snapshot_path;
+    absl::Duration connect_timeout = absl::Seconds(5);
+  };
+
+  // share must share CURL_LOCK_DATA_DNS, and should share
+  // CURL_LOCK_DATA_SSL_SESSION. It is not owned.
+  ShareWarmer(const ThreadSafeCurlShare *share, Options options);
+
+  ShareWarmer(const ShareWarmer &) = delete;
+  ShareWarmer &operator=(const ShareWarmer &) = delete;
+
+  // Resolves every host (or takes its addresses from the snapshot), seeds
+  // them into the share's DNS cache, and concurrently opens a connection to
+  // each with CURLOPT_CONNECT_ONLY, which also caches its TLS session. Then
+  // saves the snapshot. Every host is attempted; the first error is returned.
+  Status Warm();
+
+  // libcurl never expires the addresses seeded by Warm, so this must be
+  // called periodically. For each host whose addresses have outlived
+  // dns_ttl, it removes them and reconnects, letting libcurl resolve the
+  // host (and cache it with its own timeout) as usual.
+  Status Refresh(absl::Time now = absl::Now());
+
+  // The hosts seeded by Warm which have not been refreshed since.
+  const std::vector<ResolvedHost> &seeded() const;
+
+ private:
+  // Each target is a URL and the CURLOPT_RESOLVE entry to apply when
+  // connecting to it.
+  Status Connect(
+      absl::Span<const std::pair<std::string, std::string>> targets);
+
+  const ThreadSafeCurlShare *share_;
+  const Options options_;
+  std::vector<ResolvedHost> seeded_;
+};
+
+}  // namespace rhutil
+
+#endif  // RHUTIL_CURL_WARMUP_H_
@@ -1,8 +1,15 @@
 #include "rhutil/file.h"
 
+#include <unistd.h>
+
+#include <atomic>
 #include <cassert>
+#include <cstdint>
+#include <cstdio>
+#include <sstream>
 
 #include "rhutil/errno.h"
+#include "absl/strings/str_cat.h"
 #include "absl/strings/str_format.h"
 
 namespace rhutil {
@@ -22,4 +29,38 @@ StatusOr<std::ifstream> OpenInputFile(std::string_view path,
   return std::move(istrm);
 }
 
+StatusOr<std::string> ReadFileToString(std::string_view path) {
+  ASSIGN_OR_RETURN(std::ifstream in,
+                   OpenInputFile(path, std::ios::in | std::ios::binary));
+  std::ostringstream contents;
+  contents << in.rdbuf();
+  if (in.bad()) {
+    return StatusBuilder(ErrnoAsStatus()) << "Failed to read " << path;
+  }
+  return contents.str();
+}
+
+Status WriteFileAtomically(std::string_view path, std::string_view contents) {
+  static std::atomic<uint64_t> counter{0};
+  const std::string tmp = absl::StrCat(path, ".tmp.", getpid(), ".",
+                                       counter++);
+  std::ofstream out(tmp, std::ios::out | std::ios::binary | std::ios::trunc);
+  if (out.fail()) {
+    return StatusBuilder(ErrnoAsStatus()) << "Failed to open " << tmp;
+  }
+  out.write(contents.data(), contents.size());
+  out.close();
+  if (out.fail()) {
+    Status st = StatusBuilder(ErrnoAsStatus()) << "Failed to write " << tmp;
+    std::remove(tmp.c_str());
+    return st;
+  }
+  if (std::rename(tmp.c_str(), std::string(path).c_str()) != 0) {
+    Status st = StatusBuilder(ErrnoAsStatus()) << "Failed to rename " << tmp;
+    std::remove(tmp.c_str());
+    return st;
+  }
+  return OkStatus();
+}
+
 }  // namespace rhutil
@@ -3,6 +3,7 @@
 
 #include <fstream>
 #include <ios>
+#include <string>
 #include <string_view>
 
 #include "rhutil/status.h"
@@ -13,6 +14,12 @@ StatusOr<std::ifstream> OpenInputFile(std::string_view path);
 StatusOr<std::ifstream> OpenInputFile(std::string_view path,
                                       std::ios_base::openmode mode);
 
+StatusOr<std::string> ReadFileToString(std::string_view path);
+
+// Writes to a temporary file in the same directory and renames it over path,
+// so readers never see a partially written file.
+Status WriteFileAtomically(std::string_view path, std::string_view contents);
+
 }  // namespace rhutil
 
 #endif  // RHUTIL_FILE_H_
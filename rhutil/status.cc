@@ -96,6 +96,9 @@ Status AbortedError(std::string_view msg) {
 Status CancelledError(std::string_view msg) {
   return {StatusCode::kCancelled, msg};
 }
+Status DataLossError(std::string_view msg) {
+  return {StatusCode::kDataLoss, msg};
+}
 Status DeadlineExceededError(std::string_view msg) {
   return {StatusCode::kDeadlineExceeded, msg};
 }
@@ -118,6 +118,7 @@ std::ostream& operator<<(std::ostream& os, const StatusBuilder &builder);
 Status OkStatus();
 Status AbortedError(std::string_view msg);
 Status CancelledError(std::string_view msg);
+Status DataLossError(std::string_view msg);
 Status DeadlineExceededError(std::string_view msg);
 Status FailedPreconditionError(std::string_view msg);
 Status InternalError(std::string_view msg);